@@ -1,18 +1,48 @@
 
 #include <ActivScp.h>
 #include <ComCat.h>
+#include <DispEx.h>
 #include <comdef.h>
+#include <algorithm>
+#include <climits>
+#include <cstdlib>
+#include <deque>
+#include <map>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <string>
 #include <vector>
 
 #include "PSL/PSL.h"
+#include "aPSL.h"
 
+// APSL_STATIC builds the engine for linking into a native host: no
+// DllMain, class factory or self registration
+#ifndef APSL_STATIC
 HINSTANCE hInst;
+#endif
 
 #define APSL_ASSERT(x)
 #define APSL_TRACE(x)
 #define PACKAGE_NAME "aPSL"
 #define IID_APSL "{B7BCEFC5-FD47-4986-B418-A6686F9760CC}"
 
+// narrow encoding of script text and strings: the ANSI code page, which
+// is what PSL has always been given.  Only APSL_SOURCE_CODEPAGE=CP_UTF8
+// keeps every non-ASCII character intact; see README.md.
+#ifndef APSL_SOURCE_CODEPAGE
+#define APSL_SOURCE_CODEPAGE CP_ACP
+#endif
+
+// the module's operator new charges the engine current on the thread;
+// define APSL_CHARGE_ALLOCATIONS=0 when linking aPSL_static.lib into a
+// program with an operator new of its own.  Nothing is charged then and
+// the memory quota has no effect.
+#ifndef APSL_CHARGE_ALLOCATIONS
+#define APSL_CHARGE_ALLOCATIONS 1
+#endif
+
 
 namespace aPSL { namespace util {
     
@@ -56,501 +86,4331 @@ namespace aPSL { namespace util {
         }
     };
 
-} } // namespace aPSL::util
+    //////////////////////////////////////////////////////////////////////////
+    //
+    //  @class thread_local_pointer
+    //  @brief per-thread pointer slot backed by TlsAlloc
+    //
+    template <typename T>
+    class thread_local_pointer
+    {
+    public:
+        thread_local_pointer() throw()
+        : index_(TlsAlloc())
+        {
+            APSL_ASSERT(TLS_OUT_OF_INDEXES != index_);
+        }
 
-namespace aPSL {
+        ~thread_local_pointer() throw()
+        {
+            TlsFree(index_);
+        }
 
-    VARIANT variable_to_variant(PSL::variable const& v);
-    PSL::variable * variant_to_variable(VARIANT const& v);
+        T *get() const throw()
+        {
+            return static_cast<T *>(TlsGetValue(index_));
+        }
 
-    class activex_object;
+        void set(T *p) throw()
+        {
+            TlsSetValue(index_, p);
+        }
 
+    private:
+        DWORD index_;
+    };
 
     //////////////////////////////////////////////////////////////////////////
     //
-    //  @class com_callable_wrapper
+    //  @fn now_ticks
     //
-    struct com_callable_wrapper
-    : IDispatch
+    inline LONGLONG now_ticks() throw()
     {
-        explicit com_callable_wrapper(PSL::variable * primitive) throw()
-        : m_count(0)
-        , primitive_(primitive)
-        {
-        }
+        LARGE_INTEGER counter;
+        QueryPerformanceCounter(&counter);
+        return counter.QuadPart;
+    }
 
-        ~com_callable_wrapper() throw()
+    //////////////////////////////////////////////////////////////////////////
+    //
+    //  @fn ticks_to_microseconds
+    //
+    inline ULONGLONG ticks_to_microseconds(LONGLONG ticks) throw()
+    {
+        static LONGLONG frequency = 0;
+        if (0 == frequency)
         {
+            LARGE_INTEGER f;
+            QueryPerformanceFrequency(&f);
+            frequency = f.QuadPart;
         }
+        return ULONGLONG(ticks / frequency * 1000000
+                         + ticks % frequency * 1000000 / frequency);
+    }
 
-    // IUnknown implementation
-        HRESULT STDMETHODCALLTYPE QueryInterface(
-                /* [in] */ REFIID riid,
-                /* [iid_is][out] */ void __RPC_FAR *__RPC_FAR *ppvObject) throw()
+    //////////////////////////////////////////////////////////////////////////
+    //
+    //  @fn narrow
+    //  @brief UTF-16 to APSL_SOURCE_CODEPAGE into an exactly sized buffer
+    //
+    inline size_t narrow(wchar_t const *src, size_t length, std::string& out)
+    {
+        out.clear();
+        if (0 == length)
+            return 0;
+        int const size = WideCharToMultiByte(
+            APSL_SOURCE_CODEPAGE, 0, src, int(length), NULL, 0, NULL, NULL);
+        if (size <= 0)
+            throw std::runtime_error("narrow: invalid UTF-16 text");
+        out.resize(size);
+        WideCharToMultiByte(
+            APSL_SOURCE_CODEPAGE, 0, src, int(length), &out[0], size, NULL, NULL);
+        return size_t(size);
+    }
+
+    inline std::string narrow(wchar_t const *src)
+    {
+        std::string result;
+        if (src)
+            narrow(src, wcslen(src), result);
+        return result;
+    }
+
+    //////////////////////////////////////////////////////////////////////////
+    //
+    //  @fn widen
+    //  @brief APSL_SOURCE_CODEPAGE to UTF-16
+    //
+    inline std::wstring widen(char const *src, size_t length)
+    {
+        std::wstring result;
+        if (0 == length)
+            return result;
+        int const size = MultiByteToWideChar(
+            APSL_SOURCE_CODEPAGE, 0, src, int(length), NULL, 0);
+        if (size <= 0)
+            throw std::runtime_error("widen: invalid text");
+        result.resize(size);
+        MultiByteToWideChar(APSL_SOURCE_CODEPAGE, 0, src, int(length), &result[0], size);
+        return result;
+    }
+
+    inline std::wstring widen(char const *src)
+    {
+        return widen(src, src ? strlen(src): 0);
+    }
+
+    //////////////////////////////////////////////////////////////////////////
+    //
+    //  @fn to_bstr
+    //  @brief APSL_SOURCE_CODEPAGE to a newly allocated BSTR
+    //
+    inline BSTR to_bstr(char const *src, size_t length)
+    {
+        int const size = length > 0 ? MultiByteToWideChar(
+            APSL_SOURCE_CODEPAGE, 0, src, int(length), NULL, 0): 0;
+        BSTR result = SysAllocStringLen(NULL, UINT(size));
+        if (NULL == result)
+            throw std::bad_alloc();
+        if (size > 0)
+            MultiByteToWideChar(APSL_SOURCE_CODEPAGE, 0, src, int(length), result, size);
+        return result;
+    }
+
+    inline BSTR to_bstr(char const *src)
+    {
+        return to_bstr(src, src ? strlen(src): 0);
+    }
+
+    //////////////////////////////////////////////////////////////////////////
+    //
+    //  Ownership at the COM boundary
+    //
+    //  - a VARIANT or BSTR we create is held by one of the classes below
+    //    until it is cleared or detach()ed into an [out] parameter;
+    //  - [in] arguments and VARIANTs we are handed are borrowed: they are
+    //    read, never cleared, and any value kept is a copy or an AddRef;
+    //  - [out] results from the host are received into a scoped_variant.
+    //
+
+    //////////////////////////////////////////////////////////////////////////
+    //
+    //  @class scoped_variant
+    //  @brief move-only owner of a VARIANT
+    //
+    class scoped_variant
+    {
+    public:
+        scoped_variant() throw()
         {
-	        if (!ppvObject)
-	            return E_POINTER;
-	        if (IsEqualIID(riid, IID_IUnknown) || IsEqualIID(riid, IID_IDispatch))
-	            return *ppvObject = this, S_OK;
-	        return E_NOINTERFACE;
+            VariantInit(&v_);
         }
 
-        ULONG STDMETHODCALLTYPE AddRef() throw()
+        // adopts v; the caller gives up its ownership
+        explicit scoped_variant(VARIANT const& v) throw()
+        : v_(v)
         {
-            util::scoped_lock lock(critical_section_);
-            return ++ m_count;
         }
 
-        ULONG STDMETHODCALLTYPE Release() throw()
+        scoped_variant(scoped_variant&& other) throw()
+        : v_(other.v_)
         {
-            util::scoped_lock lock(critical_section_);
-            if (m_count < 1)
-                delete this;
-            return -- m_count;
+            other.v_.vt = VT_EMPTY;
         }
 
-    // IDispatch implementation
-        STDMETHOD(GetTypeInfoCount)(UINT*) throw()
+        scoped_variant& operator = (scoped_variant&& other) throw()
         {
-            return E_NOTIMPL;
+            if (this != &other)
+            {
+                VariantClear(&v_);
+                v_ = other.v_;
+                other.v_.vt = VT_EMPTY;
+            }
+            return *this;
         }
 
-        STDMETHOD(GetTypeInfo)(UINT, LCID, ITypeInfo**) throw()
+        ~scoped_variant() throw()
         {
-            return E_NOTIMPL;
+            VariantClear(&v_);
         }
 
-        STDMETHOD(GetIDsOfNames)(
-            REFIID,
-            LPOLESTR* rgszNames,
-            UINT cNames,
-            LCID,
-            DISPID* rgdispid) throw()
+        VARIANT& get() throw()
         {
-            util::scoped_lock lock(critical_section_);
-            APSL_ASSERT(cNames == 1);
-            key_.push_back(*rgszNames);
-            *rgdispid = DISPID(key_.size());
-            return S_OK;
+            return v_;
         }
 
-        STDMETHOD(Invoke)(
-            DISPID dispidMember,
-            REFIID,
-            LCID,
-            WORD wFlags,
-            DISPPARAMS* pdispparams,
-            VARIANT* pvarResult,
-            EXCEPINFO* pexcepinfo,
-            UINT* puArgErr)
+        VARIANT const& get() const throw()
         {
-            util::scoped_lock lock(critical_section_);
-            switch (wFlags)
-            {
-            case DISPATCH_METHOD:
-                return invoke_method(pdispparams, pvarResult);
-            case DISPATCH_PROPERTYGET:
-                return invoke_propertyget(dispidMember, pvarResult);
-            default:
-                APSL_ASSERT(!"com_callable_wrapper::Invoke");
-			    return E_UNEXPECTED;
-            }
-            __assume(0);
+            return v_;
         }
-    private:
-        HRESULT invoke_method(DISPPARAMS* pdispparams, VARIANT* pvarResult) const throw()
+
+        // for [out] parameters: clears the current value first
+        VARIANT *receive() throw()
         {
-            try {
-                PSL::variable arg(PSL::variable::RARRAY);
-                for (UINT i = 0; i < pdispparams->cArgs; ++i)
-                   arg.push(variant_to_variable(pdispparams->rgvarg[pdispparams->cArgs - i - 1]));
-                *pvarResult = variable_to_variant(primitive_->operator ()(arg));
-            }
-            catch (...) {
-                APSL_ASSERT(0);
-                *pvarResult = _variant_t();
-                return E_UNEXPECTED;
-            }
-            return S_OK;
+            VariantClear(&v_);
+            return &v_;
         }
 
-        HRESULT invoke_propertyget(DISPID dispidMember, VARIANT* pvarResult) const throw()
+        VARIANT detach() throw()
         {
-            try {
-                if (dispidMember == 0)
-                {
-                    const char *str = primitive_->operator PSL::string();
-                    BSTR olestr = _bstr_t(str);
-                    *pvarResult = _variant_t(olestr);
-                }
-                else
-                {
-                    *pvarResult = variable_to_variant(primitive_[(key_[dispidMember - 1])]);
-                }
-                return S_OK;
-            }
-            catch (...) {
-                *pvarResult = _variant_t();
-                return E_UNEXPECTED;
-            }
+            VARIANT v = v_;
+            v_.vt = VT_EMPTY;
+            return v;
         }
 
     private:
-        ULONG m_count;
-        PSL::variable * primitive_;
-        util::critical_section critical_section_;
-        std::vector<PSL::string> key_;
+        scoped_variant(scoped_variant const&);
+        scoped_variant& operator = (scoped_variant const&);
+
+        VARIANT v_;
     };
 
-    VARIANT variable_to_variant(PSL::variable const& v)
+    //////////////////////////////////////////////////////////////////////////
+    //
+    //  @class scoped_bstr
+    //  @brief move-only owner of a BSTR
+    //
+    class scoped_bstr
     {
-        switch (v.type()) {
+    public:
+        explicit scoped_bstr(BSTR bstr = NULL) throw()
+        : bstr_(bstr)
+        {
+        }
 
-        case PSL::variable::NIL:
+        scoped_bstr(scoped_bstr&& other) throw()
+        : bstr_(other.bstr_)
+        {
+            other.bstr_ = NULL;
+        }
+
+        scoped_bstr& operator = (scoped_bstr&& other) throw()
+        {
+            if (this != &other)
             {
-                VARIANT v;
-                v.vt = VT_NULL;
-                return v;
+                SysFreeString(bstr_);
+                bstr_ = other.bstr_;
+                other.bstr_ = NULL;
             }
-            break;
-
-		case PSL::variable::INT:
-            return _variant_t(v.operator int());
-
-		case PSL::variable::HEX:
-            return _variant_t(v.operator unsigned char());
-
-		case PSL::variable::FLOAT:
-            return _variant_t(v.operator double());
+            return *this;
+        }
 
-		case PSL::variable::STRING:
-            return _variant_t(v.operator char const *());
+        ~scoped_bstr() throw()
+        {
+            SysFreeString(bstr_);
+        }
 
-		case PSL::variable::POINTER:
-            return _variant_t((LPDISPATCH)(void *)v);
+        BSTR get() const throw()
+        {
+            return bstr_;
+        }
 
-		case PSL::variable::RARRAY:
-            APSL_ASSERT(0);
-            // TODO:
-            //x = new vRArray();
-            break;
+        BSTR detach() throw()
+        {
+            BSTR bstr = bstr_;
+            bstr_ = NULL;
+            return bstr;
+        }
 
-		case PSL::variable::THREAD:
-            APSL_ASSERT(0);
-            // TODO:
-            //x = new vThread();
-            //return reinterpret_cast<runtime_callable_wrapper const&>(value).get_dispatch();
-            break;
+    private:
+        scoped_bstr(scoped_bstr const&);
+        scoped_bstr& operator = (scoped_bstr const&);
 
-		default:
-            {
-                // TODO: exception handling
-                IDispatch *pdisp = new aPSL::com_callable_wrapper(v);
-                pdisp->AddRef();
-                return _variant_t(pdisp);
-            }
-        }
-        __assume(0);
-    }
+        BSTR bstr_;
+    };
 
     //////////////////////////////////////////////////////////////////////////
     //
-    //  @class runtime_callable_wrapper
+    //  @class variant_array
+    //  @brief owned, contiguous VARIANTs for DISPPARAMS::rgvarg
     //
-    class runtime_callable_wrapper : public PSL::variable
+    class variant_array
     {
     public:
-        explicit runtime_callable_wrapper(IDispatch *pDispatch, DISPID dispid) throw()
-        : m_pDispatch(pDispatch)
-        , m_dispid(dispid)
-        {
-            m_pDispatch->AddRef();
-        }
-
-        ~runtime_callable_wrapper() throw()
+        explicit variant_array(size_t size)
+        : v_(size)
         {
-            m_pDispatch->Release();
+            for (size_t i = 0; i < size; ++i)
+                VariantInit(&v_[i]);
         }
 
-        PSL::variable * __stdcall call__(PSL::variable& /*this_arg*/, PSL::variable& arguments)
+        ~variant_array() throw()
         {
-            return call_impl(arguments);
+            for (size_t i = 0; i < v_.size(); ++i)
+                VariantClear(&v_[i]);
         }
 
-        PSL::variable * __stdcall get_value__()
+        // takes over the value held by v
+        void set(size_t i, scoped_variant&& v) throw()
         {
-            return get_value_impl();
+            VariantClear(&v_[i]);
+            v_[i] = v.detach();
         }
 
-        PSL::variable * __stdcall assign__(PSL::variable& rhs)
+        VARIANT *data() throw()
         {
-            return assign_impl(rhs);
+            return v_.empty() ? NULL: &v_[0];
         }
 
-        IDispatch *get_dispatch() const
+        size_t size() const throw()
         {
-            return m_pDispatch;
+            return v_.size();
         }
 
     private:
-        PSL::variable * __stdcall call_impl(PSL::variable& arguments)
-        {
-            VARIANT result = {VT_EMPTY};
-            EXCEPINFO excepinfo = {0};
-            UINT argerr = 0;
-            std::vector<VARIANTARG> variant_arg;
-            size_t length = arguments.length();
-            for (size_t i = 0; i < length; ++i)
-                variant_arg.push_back(variable_to_variant(arguments[length - i - 1]));
-            DISPPARAMS params
-                = {length > 0 ? &*variant_arg.begin(): NULL, NULL, length, 0};
-            HRESULT hr = m_pDispatch->Invoke(
-                m_dispid, IID_NULL, LOCALE_USER_DEFAULT,
-                DISPATCH_METHOD, &params, &result, &excepinfo, &argerr);
-            if (DISP_E_EXCEPTION == hr)
-                APSL_ASSERT(0);
-            if (FAILED(hr))
-                APSL_ASSERT(0);
-            return variant_to_variable(result);
-        }
+        variant_array(variant_array const&);
+        variant_array& operator = (variant_array const&);
 
-        PSL::variable * get_value_impl()
+        std::vector<VARIANT> v_;
+    };
+
+    //////////////////////////////////////////////////////////////////////////
+    //
+    //  @struct scoped_excepinfo
+    //  @brief EXCEPINFO whose strings are freed on scope exit
+    //
+    struct scoped_excepinfo
+    : EXCEPINFO
+    {
+        scoped_excepinfo() throw()
         {
-            VARIANT result = {VT_EMPTY};
-            EXCEPINFO excepinfo = {0};
-            UINT argerr = 0;
-            DISPPARAMS params = {NULL, NULL, 0, 0};
-            HRESULT hr = m_pDispatch->Invoke(
-                m_dispid, IID_NULL, LOCALE_USER_DEFAULT,
-                DISPATCH_PROPERTYGET, &params, &result, &excepinfo, &argerr);
-            if (FAILED(hr))
-                APSL_ASSERT(0);
-            return variant_to_variable(result);
+            ZeroMemory(static_cast<EXCEPINFO *>(this), sizeof(EXCEPINFO));
         }
 
-        PSL::variable * assign_impl(PSL::variable& rhs)
+        ~scoped_excepinfo() throw()
         {
-            VARIANT result = {VT_EMPTY};
-            EXCEPINFO excepinfo = {0};
-            UINT argerr = 0;
-            VARIANT value = variable_to_variant(rhs);
-            DISPID dispid = DISPID_PROPERTYPUT;
-            DISPPARAMS params = {&value, &dispid, 1, 1};
-            HRESULT hr = m_pDispatch->Invoke(
-                m_dispid, IID_NULL, LOCALE_USER_DEFAULT,
-                DISPATCH_PROPERTYPUT, &params, &result, &excepinfo, &argerr);
-            if (FAILED(hr))
-                APSL_ASSERT(0);
-            return rhs;
+            SysFreeString(bstrSource);
+            SysFreeString(bstrDescription);
+            SysFreeString(bstrHelpFile);
         }
 
     private:
-        IDispatch *m_pDispatch;
-        DISPID m_dispid;
+        scoped_excepinfo(scoped_excepinfo const&);
+        scoped_excepinfo& operator = (scoped_excepinfo const&);
     };
 
+    //////////////////////////////////////////////////////////////////////////
+    //
+    //  @fn atomic_add
+    //  @brief returns the new value
+    //
+    inline LONG_PTR atomic_add(LONG_PTR volatile *p, LONG_PTR n) throw()
+    {
+#ifdef _WIN64
+        return InterlockedExchangeAdd64(p, n) + n;
+#else
+        return InterlockedExchangeAdd(reinterpret_cast<LONG volatile *>(p), n) + n;
+#endif
+    }
 
     //////////////////////////////////////////////////////////////////////////
     //
-    //  @class activex_object
+    //  @fn atomic_max
+    //  @brief raises *p to n unless it is already at least n
     //
-    class activex_object: public PSL::variable
+    inline void atomic_max(LONG_PTR volatile *p, LONG_PTR n) throw()
     {
-    public:
-        explicit activex_object(LPDISPATCH pdisp) throw()
-        : PSL::variable(pdisp)
-        , m_pDispatch(pdisp)
+        for (LONG_PTR seen = *p; seen < n; )
         {
-            APSL_ASSERT (NULL != m_pDispatch);
-            m_pDispatch->AddRef();
+#ifdef _WIN64
+            LONG_PTR const previous = InterlockedCompareExchange64(p, n, seen);
+#else
+            LONG_PTR const previous = InterlockedCompareExchange(
+                reinterpret_cast<LONG volatile *>(p), n, seen);
+#endif
+            if (previous == seen)
+                return;
+            seen = previous;
         }
+    }
 
-        virtual ~activex_object() throw()
-        {
-            m_pDispatch->Release();
-        }
+} } // namespace aPSL::util
 
-        PSL::variable * __stdcall get__(PSL::string const& key)
+namespace aPSL {
+
+    //////////////////////////////////////////////////////////////////////////
+    //
+    //  @class memory_arena
+    //  @brief bytes allocated on behalf of one engine
+    //
+    //  Every operator new of this module made while the engine is current
+    //  on the thread is charged to its arena: PSL values and strings, the
+    //  wrappers on either side of the COM boundary, transcoded source.
+    //  Each block carries a header naming its arena and holds a reference,
+    //  so the arena outlives its engine for as long as blocks charged to
+    //  it do; they may be freed on any thread.  Allocations are refused
+    //  past the quota only while script code runs (see quota_scope);
+    //  elsewhere the engine compares the total at safe points (see
+    //  script_engine::check_quota).
+    //
+    class memory_arena
+    {
+    public:
+        memory_arena() throw()
+        : refcount_(1)
+        , current_(0)
+        , peak_(0)
+        , quota_(0)
+        , enforcing_(0)
         {
-            return get_impl(key);
         }
 
-        void __stdcall put__(PSL::string const& key, PSL::variable *rhs)
+        void add_ref() throw()
         {
-            put_impl(key, rhs);
+            InterlockedIncrement(&refcount_);
         }
 
-    private:
-        PSL::variable *get_impl(PSL::string const& key)
+        void release() throw()
         {
-            LPOLESTR rgszNames = _bstr_t(key.c_str());
-            DISPID rgDispid = 0;
-            HRESULT hr = S_OK;
-            hr = m_pDispatch->GetIDsOfNames(
-                IID_NULL, &rgszNames, 1, LOCALE_USER_DEFAULT, &rgDispid);
-            if (hr == DISP_E_UNKNOWNNAME)
-                return this->operator [] (key);
-            if (SUCCEEDED(hr))
-                return new runtime_callable_wrapper(m_pDispatch, rgDispid);
-//            _com_error const e(hr);
-//            fwprintf(stderr, L"com error: code=%d message=%s\n", e.Error(), e.ErrorMessage());
-            throw std::runtime_error("com error: ");
+            if (0 == InterlockedDecrement(&refcount_))
+                delete this;
         }
 
-     private:
-        void put_impl(PSL::string const& key, PSL::variable *rhs)
+        void charge(size_t n) throw()
         {
-            LPOLESTR rgszNames = _bstr_t(key.c_str());
-            DISPID rgDispid = 0;
-            HRESULT hr = m_pDispatch->GetIDsOfNames(
-                IID_NULL, &rgszNames, 1, LOCALE_USER_DEFAULT, &rgDispid);
-            if (hr != S_OK)
-                throw (hr);
-            VARIANT result = {VT_EMPTY};
-            EXCEPINFO excepinfo = {0};
-            UINT argerr = 0;
-            VARIANT value = variable_to_variant(rhs);
-            DISPPARAMS params = {&value, &rgDispid, 1, 1};
-            hr = m_pDispatch->Invoke(
-                rgDispid, IID_NULL, LOCALE_USER_DEFAULT,
-                DISPATCH_PROPERTYPUT, &params, &result, &excepinfo, &argerr);
-            if (FAILED(hr))
-                throw (hr);
-            hr = m_pDispatch->GetIDsOfNames(
-                IID_NULL, &rgszNames, 1, LOCALE_USER_DEFAULT, &rgDispid);
-            if (hr != S_OK)
-                throw (hr);
+            add_ref();
+            util::atomic_max(&peak_, util::atomic_add(&current_, LONG_PTR(n)));
         }
 
-     private:
-        IDispatch *m_pDispatch;
+        void discharge(size_t n) throw()
+        {
+            util::atomic_add(&current_, -LONG_PTR(n));
+            release();
+        }
+
+        ULONGLONG current() const throw()
+        {
+            return ULONGLONG(current_);
+        }
+
+        ULONGLONG peak() const throw()
+        {
+            return ULONGLONG(peak_);
+        }
+
+        ULONGLONG quota() const throw()
+        {
+            return quota_;
+        }
+
+        void set_quota(ULONGLONG quota) throw()
+        {
+            quota_ = quota;
+        }
+
+        bool over_quota() const throw()
+        {
+            return 0 != quota_ && ULONGLONG(current_) > quota_;
+        }
+
+        // whether an allocation past the quota is refused where it happens
+        bool enforcing() const throw()
+        {
+            return 0 != enforcing_;
+        }
+
+    private:
+        friend class quota_scope;
+
+        ~memory_arena() throw()
+        {
+        }
+
+        memory_arena(memory_arena const&);
+        memory_arena& operator = (memory_arena const&);
+
+        LONG volatile refcount_;
+        LONG_PTR volatile current_;
+        LONG_PTR volatile peak_;
+        ULONGLONG quota_;
+        LONG enforcing_; // the engine's thread only
     };
 
+    // constant initialized, so allocations made during static
+    // initialization see no arena rather than an unallocated slot
+    static LONG volatile arena_slot = LONG(TLS_OUT_OF_INDEXES);
 
-    PSL::variable * variant_to_variable(VARIANT const& v)
+    inline memory_arena *current_arena() throw()
+    {
+        DWORD const slot = DWORD(arena_slot);
+        if (TLS_OUT_OF_INDEXES == slot)
+            return NULL;
+        DWORD const error = GetLastError(); // TlsGetValue clears it
+        memory_arena *arena = static_cast<memory_arena *>(TlsGetValue(slot));
+        SetLastError(error);
+        return arena;
+    }
+
+    inline void set_current_arena(memory_arena *arena) throw()
     {
-        switch (v.vt & VT_TYPEMASK)
+        if (TLS_OUT_OF_INDEXES == DWORD(arena_slot))
         {
-        case VT_DISPATCH:
-            return new aPSL::activex_object(v.vt & VT_BYREF ? *v.ppdispVal: v.pdispVal);
-        case VT_EMPTY:
-            return new PSL::variable; // NIL
-        case VT_NULL:
-            return new PSL::variable; // NIL
-        case VT_BOOL:
-            if ((v.vt & VT_BYREF ? *v.pboolVal: v.boolVal) == VARIANT_TRUE)
-                return new PSL::variable(1);
-            else
-                return new PSL::variable(0);
-        case VT_BSTR:
-            {
-                BSTR bstr = v.vt & VT_BYREF ? *v.pbstrVal: v.bstrVal;
-                if (!bstr)
-                    return new PSL::variable("");
-                UINT length = ::SysStringByteLen(bstr);
-                const char *str = _bstr_t(bstr, bstr + length);
-                PSL::variable *result = new PSL::variable(PSL::string(str));
-                ::SysFreeString(bstr);
-                return result;
-            }
-        case VT_I4:
-            return new PSL::variable(v.vt & VT_BYREF ? *v.plVal: v.lVal);
-        case VT_UI4:
-            return new PSL::variable(v.vt & VT_BYREF ? *v.pulVal: v.ulVal);
-        case VT_R8:
-            return new PSL::variable(v.vt & VT_BYREF ? *v.pdblVal: v.dblVal);
-        case VT_ARRAY:
-        case VT_VECTOR:
-            APSL_ASSERT(0);
-        default:
-            APSL_ASSERT(0);
+            LONG const slot = LONG(TlsAlloc());
+            if (LONG(TLS_OUT_OF_INDEXES) != InterlockedCompareExchange(
+                    &arena_slot, slot, LONG(TLS_OUT_OF_INDEXES)))
+                TlsFree(DWORD(slot));
         }
-        __assume(0);
+        TlsSetValue(DWORD(arena_slot), arena);
     }
 
+    //////////////////////////////////////////////////////////////////////////
+    //
+    //  @class quota_scope
+    //  @brief script code runs; allocations past the current arena's
+    //         quota are refused
+    //
+    //  The VM is the only code that can allocate without bound, and it
+    //  unwinds from a bad_alloc like from any script error; so do the
+    //  host calls and native functions it makes.  The engine's own
+    //  bookkeeping around it is left to the safe points.
+    //
+    class quota_scope
+    {
+    public:
+        quota_scope() throw()
+        : arena_(current_arena())
+        {
+            if (arena_)
+                ++arena_->enforcing_;
+        }
+
+        ~quota_scope() throw()
+        {
+            if (arena_)
+                --arena_->enforcing_;
+        }
+
+    private:
+        quota_scope(quota_scope const&);
+        quota_scope& operator = (quota_scope const&);
+
+        memory_arena *arena_;
+    };
+
+    // collects what the engine can give back without calling the host,
+    // then refuses an allocation still past the quota
+    void refuse_over_quota(memory_arena& arena, size_t n);
+
+#if APSL_CHARGE_ALLOCATIONS
+    //////////////////////////////////////////////////////////////////////////
+    //
+    //  @struct block_header
+    //  @brief precedes every block from operator new; keeps its alignment
+    //
+    struct block_header
+    {
+        memory_arena *arena;
+        size_t size;
+    };
+#endif
+
 } // namespace aPSL
 
+#if APSL_CHARGE_ALLOCATIONS
+void *operator new(size_t size)
+{
+    aPSL::memory_arena *arena = aPSL::current_arena();
+    if (arena)
+    {
+        arena->charge(size);
+        if (arena->enforcing() && arena->over_quota())
+            aPSL::refuse_over_quota(*arena, size);
+    }
+    aPSL::block_header *header = static_cast<aPSL::block_header *>(
+        malloc(sizeof(aPSL::block_header) + size));
+    if (!header)
+    {
+        if (arena)
+            arena->discharge(size);
+        throw std::bad_alloc();
+    }
+    header->arena = arena;
+    header->size = size;
+    return header + 1;
+}
+
+void *operator new(size_t size, std::nothrow_t const&) throw()
+{
+    try {
+        return operator new(size);
+    }
+    catch (...) {
+        return NULL;
+    }
+}
+
+void *operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+void *operator new[](size_t size, std::nothrow_t const& nothrow) throw()
+{
+    return operator new(size, nothrow);
+}
+
+void operator delete(void *p) throw()
+{
+    if (!p)
+        return;
+    aPSL::block_header *header = static_cast<aPSL::block_header *>(p) - 1;
+    if (header->arena)
+        header->arena->discharge(header->size);
+    free(header);
+}
+
+void operator delete(void *p, std::nothrow_t const&) throw()
+{
+    operator delete(p);
+}
+
+void operator delete[](void *p) throw()
+{
+    operator delete(p);
+}
+
+void operator delete[](void *p, std::nothrow_t const&) throw()
+{
+    operator delete(p);
+}
+#endif // APSL_CHARGE_ALLOCATIONS
 
 namespace aPSL {
 
-    //////////////////////////////////////////////////////////////////////
+    //////////////////////////////////////////////////////////////////////////
     //
-    //  @class scriptsite_object
+    //  @fn fill_excepinfo
+    //  @brief reports a failure to the caller of the outermost boundary
     //
-    class scriptsite_object 
-    : public PSL::variable
+    inline HRESULT fill_excepinfo(EXCEPINFO *pexcepinfo, HRESULT scode, LPCOLESTR description)
+    {
+        if (pexcepinfo)
+        {
+            ZeroMemory(pexcepinfo, sizeof(*pexcepinfo));
+            pexcepinfo->bstrSource = SysAllocString(L"" PACKAGE_NAME);
+            pexcepinfo->bstrDescription = SysAllocString(description);
+            pexcepinfo->scode = scode;
+        }
+        return DISP_E_EXCEPTION;
+    }
+
+    //////////////////////////////////////////////////////////////////////////
+    //
+    //  @fn report_exception
+    //  @brief translates the exception being handled; call from catch (...)
+    //
+    inline HRESULT report_exception(EXCEPINFO *pexcepinfo) throw()
+    {
+        try {
+            throw;
+        }
+        catch (host_error const& e) {
+            return fill_excepinfo(pexcepinfo, e.hr(), e.description());
+        }
+        catch (quota_exceeded const&) {
+            return fill_excepinfo(
+                pexcepinfo, E_OUTOFMEMORY, L"script exceeded its memory quota");
+        }
+        catch (...) {
+            return E_UNEXPECTED;
+        }
+    }
+
+    //////////////////////////////////////////////////////////////////////////
+    //
+    //  @class engine_stats
+    //  @brief cheap runtime counters owned by a script engine
+    //
+    //  Wrappers keep a reference to the stats of the engine they were
+    //  created for, so the counters may outlive the engine itself and are
+    //  bumped from whatever thread releases a wrapper; every counter is
+    //  therefore updated and read with interlocked operations.
+    //
+    class engine_stats
     {
     public:
-        explicit scriptsite_object(IActiveScriptSite *pActiveScriptSite)
-        : m_pActiveScriptSite(pActiveScriptSite)
+        enum { CONVERSION_SLOTS = VT_CLSID + 2 }; // last slot: any other type
+
+        engine_stats() throw()
+        : refcount_(1)
         {
-            APSL_ASSERT(NULL != m_pActiveScriptSite);
-            m_pActiveScriptSite->AddRef();
+            ZeroMemory(const_cast<LONGLONG *>(counters_), sizeof(counters_));
+            ZeroMemory(const_cast<LONGLONG *>(to_variant_), sizeof(to_variant_));
+            ZeroMemory(const_cast<LONGLONG *>(from_variant_), sizeof(from_variant_));
         }
-    
-        virtual ~scriptsite_object() throw()
+
+        void add_ref() throw()
         {
-            APSL_ASSERT(NULL != m_pActiveScriptSite);
-            m_pActiveScriptSite->Release();
+            InterlockedIncrement(&refcount_);
         }
-    
-        PSL::variable *get__(LPCOLESTR key)
+
+        void release() throw()
         {
-            LPDISPATCH pdisp = NULL;
-            HRESULT hr = get_member(key, &pdisp);
-            PSL::variable *result;
-            if (FAILED(hr) || NULL == pdisp)
-                result = new PSL::variable;
-            else
-                result = new aPSL::activex_object(pdisp);
-            result->ref();
-            return result;
+            if (0 == InterlockedDecrement(&refcount_))
+                delete this;
         }
-    
-        HRESULT get_member(LPCOLESTR key, LPDISPATCH *ppdisp)
+
+        void add(APSL_COUNTER counter, LONGLONG n = 1) throw()
         {
-            LPOLESTR rgszNames = const_cast<LPOLESTR>(key);
-            DISPID rgDispid = 0;
-            HRESULT hr = S_OK;
-            IUnknown *pUnkown = NULL;
-            APSL_ASSERT(0 != m_pActiveScriptSite);
-            hr = m_pActiveScriptSite->GetItemInfo(
-                rgszNames, SCRIPTINFO_IUNKNOWN, &pUnkown, NULL);
-            if (FAILED(S_OK))
-                return hr;
-            return pUnkown->QueryInterface(
-                IID_IDispatch, reinterpret_cast<LPVOID*>(ppdisp));
+            InterlockedExchangeAdd64(&counters_[counter], n);
         }
-    
+
+        void count_to_variant(VARTYPE vt) throw()
+        {
+            InterlockedIncrement64(&to_variant_[slot(vt)]);
+        }
+
+        void count_from_variant(VARTYPE vt) throw()
+        {
+            InterlockedIncrement64(&from_variant_[slot(vt)]);
+        }
+
+        ULONGLONG get(APSL_COUNTER counter) const throw()
+        {
+            switch (counter)
+            {
+            case APSL_COUNTER_COMPILE_MICROSECONDS:
+            case APSL_COUNTER_RUN_MICROSECONDS:
+            case APSL_COUNTER_GC_MICROSECONDS:
+                return util::ticks_to_microseconds(load(counters_[counter]));
+            default:
+                return ULONGLONG(load(counters_[counter]));
+            }
+        }
+
+        ULONGLONG to_variant(VARTYPE vt) const throw()
+        {
+            return ULONGLONG(load(to_variant_[slot(vt)]));
+        }
+
+        ULONGLONG from_variant(VARTYPE vt) const throw()
+        {
+            return ULONGLONG(load(from_variant_[slot(vt)]));
+        }
+
+        // everything but the wrappers still alive
+        void reset() throw()
+        {
+            for (int i = 0; i < APSL_COUNTER_MAX; ++i)
+                if (APSL_COUNTER_WRAPPERS_ALIVE != i)
+                    InterlockedExchange64(&counters_[i], 0);
+            for (size_t i = 0; i < CONVERSION_SLOTS; ++i)
+            {
+                InterlockedExchange64(&to_variant_[i], 0);
+                InterlockedExchange64(&from_variant_[i], 0);
+            }
+        }
+
     private:
-        IActiveScriptSite *m_pActiveScriptSite;
+        ~engine_stats() throw()
+        {
+        }
+
+        static size_t slot(VARTYPE vt) throw()
+        {
+            vt &= VT_TYPEMASK;
+            return vt < CONVERSION_SLOTS - 1 ? vt: CONVERSION_SLOTS - 1;
+        }
+
+        // a plain 64 bit read may tear on x86
+        static LONGLONG load(LONGLONG volatile const& counter) throw()
+        {
+            return InterlockedCompareExchange64(const_cast<LONGLONG volatile *>(&counter), 0, 0);
+        }
+
+        LONG refcount_;
+        LONGLONG volatile counters_[APSL_COUNTER_MAX];
+        LONGLONG volatile to_variant_[CONVERSION_SLOTS];
+        LONGLONG volatile from_variant_[CONVERSION_SLOTS];
     };
 
-    //////////////////////////////////////////////////////////////////////
+    //////////////////////////////////////////////////////////////////////////
     //
-    //  @class script_engine
+    //  @class scoped_timer
+    //  @brief adds the elapsed ticks of a scope to a time counter
     //
-    class script_engine
+    class scoped_timer
     {
     public:
-        script_engine()
+        scoped_timer(engine_stats& stats, APSL_COUNTER counter) throw()
+        : stats_(stats)
+        , counter_(counter)
+        , start_(util::now_ticks())
         {
         }
 
-        void eval(const char *text)
+        ~scoped_timer() throw()
         {
-            vm.LoadString(text);
-            vm.Run();
+            stats_.add(counter_, util::now_ticks() - start_);
+        }
+
+    private:
+        scoped_timer& operator = (scoped_timer const&);
+
+        engine_stats& stats_;
+        APSL_COUNTER counter_;
+        LONGLONG start_;
+    };
+
+    //////////////////////////////////////////////////////////////////////////
+    //
+    //  @class wrapper_counter
+    //  @brief counts a live wrapper against the engine that created it
+    //
+    class wrapper_counter
+    {
+    public:
+        wrapper_counter() throw();
+
+        ~wrapper_counter() throw()
+        {
+            stats_->add(APSL_COUNTER_WRAPPERS_ALIVE, -1);
+            stats_->release();
+        }
+
+        engine_stats& stats() const throw()
+        {
+            return *stats_;
+        }
+
+    private:
+        wrapper_counter(wrapper_counter const&);
+        wrapper_counter& operator = (wrapper_counter const&);
+
+        engine_stats *stats_;
+    };
+
+    //////////////////////////////////////////////////////////////////////////
+    //
+    //  @class profiler
+    //  @brief sampling profiler over a call tree of source positions
+    //
+    //  The thread running the engine keeps its stack of (cookie, line,
+    //  name) frames in a slot of this object; the sampler thread copies
+    //  that slot under a sequence count and folds it into the call tree,
+    //  so nothing on the engine side takes a lock or allocates.  A frame
+    //  costs hashing its name and a few stores while profiling, nothing
+    //  otherwise.  Names are interned by hash: the text is recorded under
+    //  the lock the first time a hash is seen, and later frames only probe
+    //  a small table of known hashes.
+    //
+    class profiler
+    {
+    public:
+        enum { IDLE = 0, MAX_DEPTH = 64, NAME_SLOTS = 1024, NAME_PROBES = 8 };
+
+        profiler() throw()
+        : sequence_(0)
+        , depth_(0)
+        , interval_(0)
+        , thread_(NULL)
+        , stop_event_(CreateEvent(NULL, TRUE, FALSE, NULL))
+        {
+            ZeroMemory(const_cast<LONG *>(names_), sizeof(names_));
+            nodes_.push_back(node(IDLE, 0, 0, 0));
+            samples_.push_back(0);
+        }
+
+        ~profiler() throw()
+        {
+            stop();
+            CloseHandle(stop_event_);
         }
 
-        void put__(const PSL::string& pstrName, const PSL::variable& v)
-        {
-            vm.add(pstrName, v);
-        }
+        bool enabled() const throw()
+        {
+            return NULL != thread_;
+        }
+
+        void enter(DWORD cookie, ULONG line, char const *name) throw()
+        {
+            push(cookie, line, intern(name));
+        }
+
+        // a frame at the source position of the caller
+        void enter(char const *name) throw()
+        {
+            LONG const depth = depth_ < MAX_DEPTH ? depth_: MAX_DEPTH;
+            if (0 == depth)
+                push(0, 0, intern(name));
+            else
+                push(stack_[depth - 1].cookie, stack_[depth - 1].line, intern(name));
+        }
+
+        void leave() throw()
+        {
+            ++sequence_;
+            --depth_;
+            ++sequence_;
+        }
+
+        HRESULT start(ULONG interval) throw()
+        {
+            if (enabled())
+                return S_FALSE;
+            interval_ = interval ? interval: 1;
+            ResetEvent(stop_event_);
+            thread_ = CreateThread(NULL, 0, &profiler::sampler_main, this, 0, NULL);
+            if (NULL == thread_)
+                return HRESULT_FROM_WIN32(GetLastError());
+            return S_OK;
+        }
+
+        void stop() throw()
+        {
+            if (!enabled())
+                return;
+            SetEvent(stop_event_);
+            WaitForSingleObject(thread_, INFINITE);
+            CloseHandle(thread_);
+            thread_ = NULL;
+        }
+
+        void clear() throw()
+        {
+            util::scoped_lock lock(critical_section_);
+            std::fill(samples_.begin(), samples_.end(), 0);
+        }
+
+        std::string report(APSL_PROFILE_VIEW view) const
+        {
+            util::scoped_lock lock(critical_section_);
+            typedef std::map<std::string, ULONGLONG> totals_map;
+            totals_map totals;
+            for (size_t i = 1; i < nodes_.size(); ++i)
+            {
+                if (0 == samples_[i])
+                    continue;
+                switch (view)
+                {
+                case APSL_PROFILE_FOLDED:
+                    totals[stack_of(LONG(i))] += samples_[i];
+                    break;
+                case APSL_PROFILE_LINES:
+                    totals[position_of(nodes_[i])] += samples_[i];
+                    break;
+                case APSL_PROFILE_FUNCTIONS:
+                    totals[name_of(nodes_[i].name)] += samples_[i];
+                    break;
+                }
+            }
+            std::vector<std::pair<ULONGLONG, std::string> > rows;
+            for (totals_map::const_iterator it = totals.begin(); it != totals.end(); ++it)
+                rows.push_back(std::make_pair(it->second, it->first));
+            if (APSL_PROFILE_FOLDED != view)
+                std::stable_sort(rows.begin(), rows.end(), hotter);
+            std::string result;
+            for (size_t i = 0; i < rows.size(); ++i)
+            {
+                char count[32];
+                _snprintf_s(count, _TRUNCATE, " %I64u\n", rows[i].first);
+                result += rows[i].second;
+                result += count;
+            }
+            return result;
+        }
+
+    private:
+        struct frame
+        {
+            DWORD cookie;
+            ULONG line;
+            ULONG name;
+        };
+
+        struct node
+        {
+            node(LONG parent, DWORD cookie, ULONG line, ULONG name)
+            : parent(parent), cookie(cookie), line(line), name(name)
+            {
+            }
+
+            bool operator < (node const& rhs) const
+            {
+                if (parent != rhs.parent)
+                    return parent < rhs.parent;
+                if (cookie != rhs.cookie)
+                    return cookie < rhs.cookie;
+                if (line != rhs.line)
+                    return line < rhs.line;
+                return name < rhs.name;
+            }
+
+            LONG parent;
+            DWORD cookie;
+            ULONG line;
+            ULONG name;
+        };
+
+        typedef std::map<node, LONG> node_map;
+
+        // an odd sequence tells the sampler the slot is being written;
+        // frames past MAX_DEPTH are counted but not recorded
+        void push(DWORD cookie, ULONG line, ULONG name) throw()
+        {
+            LONG const depth = depth_;
+            ++sequence_;
+            if (depth < MAX_DEPTH)
+            {
+                stack_[depth].cookie = cookie;
+                stack_[depth].line = line;
+                stack_[depth].name = name;
+            }
+            depth_ = depth + 1;
+            ++sequence_;
+        }
+
+        // FNV-1a; distinct names sharing a hash are reported under the
+        // first of them
+        ULONG intern(char const *name) throw()
+        {
+            ULONG hash = 2166136261UL;
+            for (unsigned char const *p = reinterpret_cast<unsigned char const *>(name); *p; ++p)
+                hash = (hash ^ *p) * 16777619UL;
+            if (0 == hash)
+                hash = 1; // zero marks a free slot
+            for (ULONG i = 0; i < NAME_PROBES; ++i)
+            {
+                LONG const known = names_[(hash + i) % NAME_SLOTS];
+                if (LONG(hash) == known)
+                    return hash;
+                if (0 == known)
+                    break;
+            }
+            record_name(hash, name);
+            return hash;
+        }
+
+        // first sighting of a name; a full probe sequence only means the
+        // name takes this path every time
+        void record_name(ULONG hash, char const *name) throw()
+        {
+            util::scoped_lock lock(critical_section_);
+            try {
+                texts_.insert(std::make_pair(hash, std::string(name)));
+            }
+            catch (...) {
+                return; // reported by hash
+            }
+            for (ULONG i = 0; i < NAME_PROBES; ++i)
+            {
+                LONG volatile *slot = &names_[(hash + i) % NAME_SLOTS];
+                if (LONG(hash) == *slot
+                    || 0 == InterlockedCompareExchange(slot, LONG(hash), 0))
+                    return;
+            }
+        }
+
+        LONG node_of(LONG parent, frame const& f)
+        {
+            node const key(parent, f.cookie, f.line, f.name);
+            node_map::const_iterator it = index_.find(key);
+            if (it != index_.end())
+                return it->second;
+            LONG const id = LONG(nodes_.size());
+            nodes_.push_back(key);
+            samples_.push_back(0);
+            index_.insert(std::make_pair(key, id));
+            return id;
+        }
+
+        std::string name_of(ULONG name) const
+        {
+            std::map<ULONG, std::string>::const_iterator it = texts_.find(name);
+            if (it != texts_.end())
+                return it->second;
+            char text[16];
+            _snprintf_s(text, _TRUNCATE, "#%08lx", name);
+            return text;
+        }
+
+        static std::string position_of(node const& n)
+        {
+            char position[32];
+            _snprintf_s(position, _TRUNCATE, "%lu:%lu", n.cookie, n.line);
+            return position;
+        }
+
+        // folded stack, outermost frame first; ';' separates frames
+        std::string stack_of(LONG id) const
+        {
+            std::string stack;
+            for (; IDLE != id; id = nodes_[id].parent)
+            {
+                std::string frame = name_of(nodes_[id].name) + " (" + position_of(nodes_[id]) + ")";
+                std::replace(frame.begin(), frame.end(), ';', ',');
+                stack = stack.empty() ? frame: frame + ";" + stack;
+            }
+            return stack;
+        }
+
+        static bool hotter(std::pair<ULONGLONG, std::string> const& lhs,
+                           std::pair<ULONGLONG, std::string> const& rhs)
+        {
+            return lhs.first > rhs.first;
+        }
+
+        // copies the slot; false when the engine was writing it throughout
+        bool snapshot(frame *frames, LONG& depth) const throw()
+        {
+            for (int attempt = 0; attempt < 4; ++attempt)
+            {
+                LONG const before = sequence_;
+                if (before & 1)
+                    continue;
+                depth = depth_;
+                if (depth > MAX_DEPTH)
+                    depth = MAX_DEPTH;
+                for (LONG i = 0; i < depth; ++i)
+                {
+                    frames[i].cookie = stack_[i].cookie;
+                    frames[i].line = stack_[i].line;
+                    frames[i].name = stack_[i].name;
+                }
+                if (before == sequence_)
+                    return true;
+            }
+            return false;
+        }
+
+        void sample() throw()
+        {
+            frame frames[MAX_DEPTH];
+            LONG depth;
+            if (!snapshot(frames, depth))
+                return;
+            util::scoped_lock lock(critical_section_);
+            try {
+                LONG position = IDLE;
+                for (LONG i = 0; i < depth; ++i)
+                    position = node_of(position, frames[i]);
+                ++samples_[position];
+            }
+            catch (...) {
+                // out of memory: drop the sample
+            }
+        }
+
+        static DWORD WINAPI sampler_main(LPVOID param) throw()
+        {
+            profiler *self = static_cast<profiler *>(param);
+            while (WAIT_TIMEOUT == WaitForSingleObject(self->stop_event_, self->interval_))
+                self->sample();
+            return 0;
+        }
+
+        profiler(profiler const&);
+        profiler& operator = (profiler const&);
+
+        // written by the engine thread only; volatile stores keep their order
+        LONG volatile sequence_;
+        LONG volatile depth_;
+        frame volatile stack_[MAX_DEPTH];
+        LONG volatile names_[NAME_SLOTS];
+
+        ULONG interval_;
+        HANDLE thread_;
+        HANDLE stop_event_;
+        mutable util::critical_section critical_section_;
+        std::vector<node> nodes_;
+        std::vector<ULONGLONG> samples_;
+        node_map index_;
+        std::map<ULONG, std::string> texts_;
+    };
+
+    profiler *current_profiler() throw();
+
+    //////////////////////////////////////////////////////////////////////////
+    //
+    //  @class profile_frame
+    //  @brief publishes a frame to the active profiler for a scope
+    //
+    class profile_frame
+    {
+    public:
+        explicit profile_frame(char const *name) throw()
+        : profiler_(current_profiler())
+        {
+            if (profiler_)
+                profiler_->enter(name);
+        }
+
+        profile_frame(profiler *p, DWORD cookie, ULONG line, char const *name) throw()
+        : profiler_(p && p->enabled() ? p: NULL)
+        {
+            if (profiler_)
+                profiler_->enter(cookie, line, name);
+        }
+
+        ~profile_frame() throw()
+        {
+            if (profiler_)
+                profiler_->leave();
+        }
+
+    private:
+        profile_frame(profile_frame const&);
+        profile_frame& operator = (profile_frame const&);
+
+        profiler *profiler_;
+    };
+
+    engine_stats& current_stats() throw();
+
+    // the result is owned by the caller
+    util::scoped_variant variable_to_variant(PSL::variable const& v);
+    // v is borrowed; the new variable holds its own copy or reference
+    PSL::variable * variant_to_variable(VARIANT const& v);
+
+    class activex_object;
+
+
+    //////////////////////////////////////////////////////////////////////////
+    //
+    //  @class com_callable_wrapper
+    //
+    //  A script value seen by the host.  Member names get DISPIDs from 1
+    //  in the order they are first asked for and keep them for the life of
+    //  the wrapper; array elements use ELEMENT_DISPID + index.  Arrays also
+    //  enumerate through DISPID_NEWENUM.
+    //
+    struct com_callable_wrapper
+    : IDispatchEx
+    {
+        enum { ELEMENT_DISPID = 0x40000000 };
+
+        explicit com_callable_wrapper(PSL::variable * primitive) throw()
+        : m_count(0)
+        , primitive_(primitive)
+        {
+        }
+
+        ~com_callable_wrapper() throw()
+        {
+        }
+
+    // IUnknown implementation
+        HRESULT STDMETHODCALLTYPE QueryInterface(
+                /* [in] */ REFIID riid,
+                /* [iid_is][out] */ void __RPC_FAR *__RPC_FAR *ppvObject) throw()
+        {
+	        if (!ppvObject)
+	            return E_POINTER;
+	        if (IsEqualIID(riid, IID_IUnknown) || IsEqualIID(riid, IID_IDispatch)
+	            || IsEqualIID(riid, IID_IDispatchEx))
+	            return *ppvObject = this, AddRef(), S_OK;
+	        *ppvObject = NULL;
+	        return E_NOINTERFACE;
+        }
+
+        ULONG STDMETHODCALLTYPE AddRef() throw()
+        {
+            util::scoped_lock lock(critical_section_);
+            return ++ m_count;
+        }
+
+        ULONG STDMETHODCALLTYPE Release() throw()
+        {
+            ULONG count;
+            {
+                util::scoped_lock lock(critical_section_);
+                count = -- m_count;
+            }
+            if (0 == count)
+                delete this;
+            return count;
+        }
+
+    // IDispatch implementation
+        STDMETHOD(GetTypeInfoCount)(UINT*) throw()
+        {
+            return E_NOTIMPL;
+        }
+
+        STDMETHOD(GetTypeInfo)(UINT, LCID, ITypeInfo**) throw()
+        {
+            return E_NOTIMPL;
+        }
+
+        STDMETHOD(GetIDsOfNames)(
+            REFIID,
+            LPOLESTR* rgszNames,
+            UINT cNames,
+            LCID,
+            DISPID* rgdispid) throw()
+        {
+            if (!rgszNames || !rgdispid)
+                return E_POINTER;
+            util::scoped_lock lock(critical_section_);
+            HRESULT hr = S_OK;
+            try {
+                for (UINT i = 0; i < cNames; ++i)
+                {
+                    // later names are argument names; script functions have none
+                    rgdispid[i] = 0 == i ? dispid_of(rgszNames[i]): DISPID_UNKNOWN;
+                    if (DISPID_UNKNOWN == rgdispid[i])
+                        hr = DISP_E_UNKNOWNNAME;
+                }
+            }
+            catch (...) {
+                return E_OUTOFMEMORY;
+            }
+            return hr;
+        }
+
+        STDMETHOD(Invoke)(
+            DISPID dispidMember,
+            REFIID,
+            LCID,
+            WORD wFlags,
+            DISPPARAMS* pdispparams,
+            VARIANT* pvarResult,
+            EXCEPINFO* pexcepinfo,
+            UINT* puArgErr)
+        {
+            return invoke(dispidMember, wFlags, pdispparams, pvarResult, pexcepinfo);
+        }
+
+    // IDispatchEx implementation
+        STDMETHOD(GetDispID)(BSTR bstrName, DWORD grfdex, DISPID *pid) throw()
+        {
+            if (!pid)
+                return E_POINTER;
+            *pid = DISPID_UNKNOWN;
+            util::scoped_lock lock(critical_section_);
+            // a new name grows key_ and dispids_ whether or not it is ensured
+            try {
+                DISPID const dispid = dispid_of(bstrName);
+                if (DISPID_UNKNOWN == dispid)
+                    return DISP_E_UNKNOWNNAME;
+                if ((grfdex & fdexNameEnsure) && dispid < ELEMENT_DISPID)
+                {
+                    PSL::string const& key = key_[dispid - 1];
+                    if (PSL::variable::NIL == (*primitive_)[key].type())
+                        primitive_->put__(key, new PSL::variable); // NIL
+                }
+                *pid = dispid;
+            }
+            catch (...) {
+                return E_OUTOFMEMORY;
+            }
+            return S_OK;
+        }
+
+        STDMETHOD(InvokeEx)(
+            DISPID id,
+            LCID,
+            WORD wFlags,
+            DISPPARAMS *pdp,
+            VARIANT *pvarRes,
+            EXCEPINFO *pei,
+            IServiceProvider *)
+        {
+            return invoke(id, wFlags, pdp, pvarRes, pei);
+        }
+
+        STDMETHOD(DeleteMemberByName)(BSTR, DWORD) throw()
+        {
+            return S_FALSE;
+        }
+
+        STDMETHOD(DeleteMemberByDispID)(DISPID) throw()
+        {
+            return S_FALSE;
+        }
+
+        STDMETHOD(GetMemberProperties)(DISPID, DWORD, DWORD *) throw()
+        {
+            return E_NOTIMPL;
+        }
+
+        STDMETHOD(GetMemberName)(DISPID id, BSTR *pbstrName) throw()
+        {
+            if (!pbstrName)
+                return E_POINTER;
+            *pbstrName = NULL;
+            util::scoped_lock lock(critical_section_);
+            try {
+                if (ELEMENT_DISPID <= id)
+                {
+                    char index[16];
+                    wsprintfA(index, "%d", id - ELEMENT_DISPID);
+                    *pbstrName = util::to_bstr(index);
+                }
+                else if (0 < id && size_t(id) <= key_.size())
+                {
+                    *pbstrName = util::to_bstr(key_[id - 1]);
+                }
+                else
+                {
+                    return DISP_E_UNKNOWNNAME;
+                }
+            }
+            catch (...) {
+                return E_OUTOFMEMORY;
+            }
+            return *pbstrName ? S_OK: E_OUTOFMEMORY;
+        }
+
+        // arrays walk their elements; other objects the names handed out
+        STDMETHOD(GetNextDispID)(DWORD, DISPID id, DISPID *pid) throw()
+        {
+            if (!pid)
+                return E_POINTER;
+            util::scoped_lock lock(critical_section_);
+            *pid = DISPID_UNKNOWN;
+            if (PSL::variable::RARRAY == primitive_->type())
+            {
+                DISPID const next = DISPID_STARTENUM == id ? ELEMENT_DISPID: id + 1;
+                if (next < ELEMENT_DISPID || primitive_->length() <= size_t(next - ELEMENT_DISPID))
+                    return S_FALSE;
+                *pid = next;
+                return S_OK;
+            }
+            DISPID const next = DISPID_STARTENUM == id ? 1: id + 1;
+            if (next < 1 || key_.size() < size_t(next))
+                return S_FALSE;
+            *pid = next;
+            return S_OK;
+        }
+
+        STDMETHOD(GetNameSpaceParent)(IUnknown **ppunk) throw()
+        {
+            if (!ppunk)
+                return E_POINTER;
+            *ppunk = NULL;
+            return E_NOTIMPL;
+        }
+
+    private:
+        // returns DISPID_UNKNOWN for an index into a non-array
+        DISPID dispid_of(LPCOLESTR name)
+        {
+            if (!name)
+                return DISPID_UNKNOWN;
+            if (L'0' <= *name && *name <= L'9')
+            {
+                if (PSL::variable::RARRAY != primitive_->type())
+                    return DISPID_UNKNOWN;
+                DISPID index = 0;
+                for (LPCOLESTR p = name; *p; ++p)
+                {
+                    if (*p < L'0' || L'9' < *p || ELEMENT_DISPID / 10 <= index)
+                        return DISPID_UNKNOWN;
+                    index = index * 10 + (*p - L'0');
+                }
+                return ELEMENT_DISPID + index;
+            }
+            std::string const key = util::narrow(name);
+            dispid_map::const_iterator it = dispids_.find(key);
+            if (dispids_.end() != it)
+                return it->second;
+            key_.push_back(PSL::string(key.c_str()));
+            DISPID const dispid = DISPID(key_.size());
+            dispids_.insert(std::make_pair(key, dispid));
+            return dispid;
+        }
+
+        HRESULT invoke(
+            DISPID dispidMember,
+            WORD wFlags,
+            DISPPARAMS* pdispparams,
+            VARIANT* pvarResult,
+            EXCEPINFO* pexcepinfo) throw()
+        {
+            util::scoped_lock lock(critical_section_);
+            if (wFlags & (DISPATCH_PROPERTYPUT | DISPATCH_PROPERTYPUTREF))
+                return invoke_propertyput(dispidMember, pdispparams, pexcepinfo);
+            if (DISPID_NEWENUM == dispidMember)
+                return invoke_newenum(pvarResult);
+            // METHOD|PROPERTYGET without arguments is a property read
+            if ((wFlags & DISPATCH_PROPERTYGET)
+                && (!(wFlags & DISPATCH_METHOD) || !pdispparams || 0 == pdispparams->cArgs))
+                return invoke_propertyget(dispidMember, pvarResult, pexcepinfo);
+            if (wFlags & DISPATCH_METHOD)
+                return invoke_method(dispidMember, pdispparams, pvarResult, pexcepinfo);
+            APSL_ASSERT(!"com_callable_wrapper::Invoke");
+            return E_UNEXPECTED;
+        }
+
+        // rgvarg is borrowed; *pvarResult receives a value the caller owns
+        HRESULT invoke_method(
+            DISPID dispidMember,
+            DISPPARAMS* pdispparams,
+            VARIANT* pvarResult,
+            EXCEPINFO* pexcepinfo) const throw()
+        {
+            if (pvarResult)
+                VariantInit(pvarResult);
+            if (DISPID_VALUE != dispidMember && !member(dispidMember))
+                return DISP_E_MEMBERNOTFOUND;
+            try {
+                PSL::variable arg(PSL::variable::RARRAY);
+                for (UINT i = 0; i < pdispparams->cArgs; ++i)
+                   arg.push(variant_to_variable(pdispparams->rgvarg[pdispparams->cArgs - i - 1]));
+                PSL::variable function = DISPID_VALUE == dispidMember
+                    ? *primitive_: get(dispidMember);
+                util::scoped_variant result = variable_to_variant(function(arg));
+                if (pvarResult)
+                    *pvarResult = result.detach();
+            }
+            catch (...) {
+                return report_exception(pexcepinfo);
+            }
+            return S_OK;
+        }
+
+        HRESULT invoke_propertyget(
+            DISPID dispidMember,
+            VARIANT* pvarResult,
+            EXCEPINFO* pexcepinfo) const throw()
+        {
+            if (!pvarResult)
+                return E_POINTER;
+            VariantInit(pvarResult);
+            if (DISPID_VALUE != dispidMember && !member(dispidMember))
+                return DISP_E_MEMBERNOTFOUND;
+            try {
+                if (dispidMember == 0)
+                {
+                    const char *str = primitive_->operator PSL::string();
+                    pvarResult->bstrVal = util::to_bstr(str);
+                    pvarResult->vt = VT_BSTR;
+                }
+                else
+                {
+                    *pvarResult = variable_to_variant(get(dispidMember)).detach();
+                }
+                return S_OK;
+            }
+            catch (...) {
+                return report_exception(pexcepinfo);
+            }
+        }
+
+        HRESULT invoke_propertyput(
+            DISPID dispidMember,
+            DISPPARAMS* pdispparams,
+            EXCEPINFO* pexcepinfo) throw()
+        {
+            if (!pdispparams || pdispparams->cArgs < 1)
+                return DISP_E_BADPARAMCOUNT;
+            if (!member(dispidMember))
+                return DISP_E_MEMBERNOTFOUND;
+            try {
+                // the value is the first argument, named DISPID_PROPERTYPUT
+                PSL::variable *value = variant_to_variable(pdispparams->rgvarg[0]);
+                if (ELEMENT_DISPID <= dispidMember)
+                {
+                    (*primitive_)[size_t(dispidMember - ELEMENT_DISPID)] = *value;
+                    delete value;
+                }
+                else
+                {
+                    primitive_->put__(key_[dispidMember - 1], value);
+                }
+                return S_OK;
+            }
+            catch (...) {
+                return report_exception(pexcepinfo);
+            }
+        }
+
+        HRESULT invoke_newenum(VARIANT* pvarResult) throw();
+
+        bool member(DISPID dispidMember) const throw()
+        {
+            if (ELEMENT_DISPID <= dispidMember)
+                return PSL::variable::RARRAY == primitive_->type()
+                    && size_t(dispidMember - ELEMENT_DISPID) < primitive_->length();
+            return 0 < dispidMember && size_t(dispidMember) <= key_.size();
+        }
+
+        PSL::variable get(DISPID dispidMember) const
+        {
+            if (ELEMENT_DISPID <= dispidMember)
+                return (*primitive_)[size_t(dispidMember - ELEMENT_DISPID)];
+            return (*primitive_)[key_[dispidMember - 1]];
+        }
+
+    private:
+        typedef std::map<std::string, DISPID> dispid_map;
+
+        ULONG m_count;
+        PSL::variable * primitive_;
+        util::critical_section critical_section_;
+        std::vector<PSL::string> key_;
+        dispid_map dispids_;
+        wrapper_counter counter_;
+    };
+
+    //////////////////////////////////////////////////////////////////////////
+    //
+    //  @class array_enumerator
+    //  @brief IEnumVARIANT over the elements of a script array
+    //
+    //  Next converts up to celt elements per call.  The enumerator keeps
+    //  its wrapper, and so the array, alive.
+    //
+    class array_enumerator
+    : public IEnumVARIANT
+    {
+    public:
+        array_enumerator(IDispatch *owner, PSL::variable *array, ULONG position = 0) throw()
+        : m_count(0)
+        , owner_(owner)
+        , array_(array)
+        , position_(position)
+        {
+            owner_->AddRef();
+        }
+
+        ~array_enumerator() throw()
+        {
+            owner_->Release();
+        }
+
+    // IUnknown implementation
+        HRESULT STDMETHODCALLTYPE QueryInterface(REFIID riid, void **ppvObject) throw()
+        {
+	        if (!ppvObject)
+	            return E_POINTER;
+	        if (IsEqualIID(riid, IID_IUnknown) || IsEqualIID(riid, IID_IEnumVARIANT))
+	            return *ppvObject = this, AddRef(), S_OK;
+	        *ppvObject = NULL;
+	        return E_NOINTERFACE;
+        }
+
+        ULONG STDMETHODCALLTYPE AddRef() throw()
+        {
+            return InterlockedIncrement(&m_count);
+        }
+
+        ULONG STDMETHODCALLTYPE Release() throw()
+        {
+            LONG const count = InterlockedDecrement(&m_count);
+            if (0 == count)
+                delete this;
+            return count;
+        }
+
+    // IEnumVARIANT implementation
+        STDMETHOD(Next)(ULONG celt, VARIANT *rgVar, ULONG *pCeltFetched) throw()
+        {
+            if (pCeltFetched)
+                *pCeltFetched = 0;
+            if (!rgVar)
+                return E_POINTER;
+            if (!pCeltFetched && 1 < celt)
+                return E_INVALIDARG;
+            ULONG fetched = 0;
+            try {
+                size_t const length = array_->length();
+                for (; fetched < celt && position_ < length; ++fetched, ++position_)
+                    rgVar[fetched] = variable_to_variant((*array_)[size_t(position_)]).detach();
+            }
+            catch (...) {
+                for (ULONG i = 0; i < fetched; ++i)
+                    VariantClear(&rgVar[i]);
+                return E_UNEXPECTED;
+            }
+            if (pCeltFetched)
+                *pCeltFetched = fetched;
+            return fetched == celt ? S_OK: S_FALSE;
+        }
+
+        STDMETHOD(Skip)(ULONG celt) throw()
+        {
+            size_t const length = array_->length();
+            position_ = length - position_ < celt ? ULONG(length): position_ + celt;
+            return position_ < length ? S_OK: S_FALSE;
+        }
+
+        STDMETHOD(Reset)() throw()
+        {
+            position_ = 0;
+            return S_OK;
+        }
+
+        STDMETHOD(Clone)(IEnumVARIANT **ppEnum) throw()
+        {
+            if (!ppEnum)
+                return E_POINTER;
+            *ppEnum = new (std::nothrow) array_enumerator(owner_, array_, position_);
+            if (!*ppEnum)
+                return E_OUTOFMEMORY;
+            (*ppEnum)->AddRef();
+            return S_OK;
+        }
+
+    private:
+        LONG volatile m_count;
+        IDispatch *owner_;
+        PSL::variable *array_;
+        ULONG position_;
+    };
+
+    HRESULT com_callable_wrapper::invoke_newenum(VARIANT* pvarResult) throw()
+    {
+        if (!pvarResult)
+            return E_POINTER;
+        VariantInit(pvarResult);
+        if (PSL::variable::RARRAY != primitive_->type())
+            return DISP_E_MEMBERNOTFOUND;
+        IEnumVARIANT *penum = new (std::nothrow) array_enumerator(this, primitive_);
+        if (!penum)
+            return E_OUTOFMEMORY;
+        penum->AddRef();
+        pvarResult->punkVal = penum;
+        pvarResult->vt = VT_UNKNOWN;
+        return S_OK;
+    }
+
+    //////////////////////////////////////////////////////////////////////////
+    //
+    //  @struct vartype_traits
+    //  @brief C++ type and union members behind each automation VARTYPE
+    //
+    //  read() follows one level of VT_BYREF; write() stores by value.
+    //
+    template <VARTYPE VT> struct vartype_traits;
+
+#define APSL_VARTYPE(vt_, type_, member_, byref_member_)                    \
+    template <> struct vartype_traits<vt_>                                  \
+    {                                                                       \
+        typedef type_ type;                                                 \
+        static type read(VARIANT const& v) throw()                          \
+        {                                                                   \
+            return v.vt & VT_BYREF ? *v.byref_member_: v.member_;           \
+        }                                                                   \
+        static void write(VARIANT& v, type const& x) throw()                \
+        {                                                                   \
+            v.member_ = x;                                                  \
+            v.vt = vt_; /* after: DECIMAL overlaps vt */                    \
+        }                                                                   \
+    };
+
+    APSL_VARTYPE(VT_I1,       CHAR,         cVal,     pcVal)
+    APSL_VARTYPE(VT_UI1,      BYTE,         bVal,     pbVal)
+    APSL_VARTYPE(VT_I2,       SHORT,        iVal,     piVal)
+    APSL_VARTYPE(VT_UI2,      USHORT,       uiVal,    puiVal)
+    APSL_VARTYPE(VT_I4,       LONG,         lVal,     plVal)
+    APSL_VARTYPE(VT_UI4,      ULONG,        ulVal,    pulVal)
+    APSL_VARTYPE(VT_INT,      INT,          intVal,   pintVal)
+    APSL_VARTYPE(VT_UINT,     UINT,         uintVal,  puintVal)
+    APSL_VARTYPE(VT_I8,       LONGLONG,     llVal,    pllVal)
+    APSL_VARTYPE(VT_UI8,      ULONGLONG,    ullVal,   pullVal)
+    APSL_VARTYPE(VT_R4,       FLOAT,        fltVal,   pfltVal)
+    APSL_VARTYPE(VT_R8,       DOUBLE,       dblVal,   pdblVal)
+    APSL_VARTYPE(VT_DATE,     DATE,         date,     pdate)
+    APSL_VARTYPE(VT_CY,       CY,           cyVal,    pcyVal)
+    APSL_VARTYPE(VT_DECIMAL,  DECIMAL,      decVal,   pdecVal)
+    APSL_VARTYPE(VT_BOOL,     VARIANT_BOOL, boolVal,  pboolVal)
+    APSL_VARTYPE(VT_ERROR,    SCODE,        scode,    pscode)
+    APSL_VARTYPE(VT_BSTR,     BSTR,         bstrVal,  pbstrVal)
+    APSL_VARTYPE(VT_DISPATCH, IDispatch *,  pdispVal, ppdispVal)
+    APSL_VARTYPE(VT_UNKNOWN,  IUnknown *,   punkVal,  ppunkVal)
+
+#undef APSL_VARTYPE
+
+    void variable_to_variant_impl(PSL::variable const& v, VARIANT& result)
+    {
+        switch (v.type()) {
+
+        case PSL::variable::NIL:
+            result.vt = VT_NULL;
+            return;
+
+		case PSL::variable::INT:
+            vartype_traits<VT_I4>::write(result, v.operator int());
+            return;
+
+		case PSL::variable::HEX:
+            vartype_traits<VT_UI1>::write(result, v.operator unsigned char());
+            return;
+
+		case PSL::variable::FLOAT:
+            vartype_traits<VT_R8>::write(result, v.operator double());
+            return;
+
+		case PSL::variable::STRING:
+            {
+                char const *str = v.operator char const *();
+                size_t const length = strlen(str);
+                current_stats().add(APSL_COUNTER_BYTES_TRANSCODED, length);
+                result.bstrVal = util::to_bstr(str, length);
+                result.vt = VT_BSTR;
+            }
+            return;
+
+		case PSL::variable::POINTER:
+            result.pdispVal = (LPDISPATCH)(void *)v;
+            if (result.pdispVal)
+                result.pdispVal->AddRef();
+            result.vt = VT_DISPATCH;
+            return;
+
+		case PSL::variable::THREAD:
+            APSL_ASSERT(0);
+            // TODO:
+            //x = new vThread();
+            //return reinterpret_cast<runtime_callable_wrapper const&>(value).get_dispatch();
+            break;
+
+		default: // objects, functions and arrays
+            {
+                // TODO: exception handling
+                IDispatch *pdisp = new aPSL::com_callable_wrapper(v);
+                pdisp->AddRef();
+                result.pdispVal = pdisp;
+                result.vt = VT_DISPATCH;
+            }
+            return;
+        }
+        __assume(0);
+    }
+
+    util::scoped_variant variable_to_variant(PSL::variable const& v)
+    {
+        util::scoped_variant result;
+        variable_to_variant_impl(v, result.get());
+        current_stats().count_to_variant(result.get().vt);
+        return result;
+    }
+
+    //////////////////////////////////////////////////////////////////////////
+    //
+    //  @struct host_result
+    //  @brief outcome of one Invoke on a host object
+    //
+    //  Failures travel up as an HRESULT and the host's description.  Only
+    //  the hook PSLVM called decides what they mean to the script; see
+    //  host_value.
+    //
+    struct host_result
+    {
+        host_result() throw()
+        : hr(S_OK)
+        {
+        }
+
+        // the host has no such member; not an error for a script
+        bool absent() const throw()
+        {
+            return DISP_E_MEMBERNOTFOUND == hr || DISP_E_UNKNOWNNAME == hr;
+        }
+
+        HRESULT hr;
+        util::scoped_variant value;
+        std::wstring description;
+
+    private:
+        host_result(host_result const&);
+        host_result& operator = (host_result const&);
+    };
+
+    //////////////////////////////////////////////////////////////////////////
+    //
+    //  @fn invoke_host
+    //
+    inline HRESULT invoke_host(IDispatch *pdisp, DISPID dispid, WORD flags,
+                               DISPPARAMS& params, host_result& result)
+    {
+        util::scoped_excepinfo excepinfo;
+        UINT argerr = 0;
+        result.hr = pdisp->Invoke(
+            dispid, IID_NULL, LOCALE_USER_DEFAULT, flags, &params,
+            DISPATCH_PROPERTYPUT == flags ? NULL: result.value.receive(),
+            &excepinfo, &argerr);
+        if (DISP_E_EXCEPTION == result.hr)
+        {
+            if (excepinfo.pfnDeferredFillIn)
+                excepinfo.pfnDeferredFillIn(&excepinfo);
+            if (FAILED(excepinfo.scode))
+                result.hr = excepinfo.scode;
+            if (excepinfo.bstrDescription)
+                result.description.assign(
+                    excepinfo.bstrDescription, SysStringLen(excepinfo.bstrDescription));
+        }
+        return result.hr;
+    }
+
+    //////////////////////////////////////////////////////////////////////////
+    //
+    //  @fn raise_host_error
+    //  @brief aborts the script; reported at ParseScriptText or Invoke
+    //
+    __declspec(noreturn) void raise_host_error(host_result const& result, char const *name)
+    {
+        std::wstring description = result.description;
+        if (description.empty())
+            description = util::widen(name) + L": host call failed";
+        throw host_error(result.hr, description);
+    }
+
+    //////////////////////////////////////////////////////////////////////////
+    //
+    //  @fn host_value
+    //  @brief the script's view of a property read
+    //
+    //  Absent members read as nil without unwinding; other failures
+    //  abort the script.  Method calls do not come here: calling
+    //  something the host does not have is always an error.
+    //
+    inline PSL::variable *host_value(host_result const& result, char const *name)
+    {
+        if (SUCCEEDED(result.hr))
+            return variant_to_variable(result.value.get());
+        if (!result.absent())
+            raise_host_error(result, name);
+        return new PSL::variable; // NIL
+    }
+
+    //////////////////////////////////////////////////////////////////////////
+    //
+    //  @fn put_property
+    //
+    inline HRESULT put_property(IDispatch *pdisp, DISPID dispid, VARIANT& value,
+                                host_result& result)
+    {
+        DISPID named = DISPID_PROPERTYPUT;
+        DISPPARAMS params = {&value, &named, 1, 1};
+        return invoke_host(pdisp, dispid, DISPATCH_PROPERTYPUT, params, result);
+    }
+
+    inline HRESULT put_property(IDispatch *pdisp, DISPID dispid, VARIANT& value)
+    {
+        host_result result;
+        return put_property(pdisp, dispid, value, result);
+    }
+
+    //////////////////////////////////////////////////////////////////////////
+    //
+    //  @fn defer_put
+    //  @brief queues the put when the engine combines writes to name
+    //
+    inline bool defer_put(IDispatch *pdisp, DISPID dispid, char const *name,
+                          PSL::variable const& rhs)
+    {
+        script_engine *engine = script_engine::current();
+        if (!engine || !engine->write_combining())
+            return false;
+        if (0 == (engine->member_flags(name) & APSL_MEMBER_DEFERRABLE_PUT))
+            return false;
+        util::scoped_variant value = variable_to_variant(rhs);
+        engine->defer_put(pdisp, dispid, name, value.get());
+        return true;
+    }
+
+    //////////////////////////////////////////////////////////////////////////
+    //
+    //  @fn check_quota
+    //  @brief a safe point on the way to the host
+    //
+    inline void check_quota()
+    {
+        if (script_engine *engine = script_engine::current())
+            engine->check_quota();
+    }
+
+    //////////////////////////////////////////////////////////////////////////
+    //
+    //  @class runtime_callable_wrapper
+    //
+    class runtime_callable_wrapper : public PSL::variable
+    {
+    public:
+        runtime_callable_wrapper(IDispatch *pDispatch, DISPID dispid, char const *name)
+        : m_pDispatch(pDispatch)
+        , m_dispid(dispid)
+        , name_(name)
+        {
+            m_pDispatch->AddRef();
+        }
+
+        ~runtime_callable_wrapper() throw()
+        {
+            m_pDispatch->Release();
+        }
+
+        PSL::variable * __stdcall call__(PSL::variable& /*this_arg*/, PSL::variable& arguments)
+        {
+            return call_impl(arguments);
+        }
+
+        PSL::variable * __stdcall get_value__()
+        {
+            return get_value_impl();
+        }
+
+        PSL::variable * __stdcall assign__(PSL::variable& rhs)
+        {
+            return assign_impl(rhs);
+        }
+
+        IDispatch *get_dispatch() const
+        {
+            return m_pDispatch;
+        }
+
+    private:
+        PSL::variable * __stdcall call_impl(PSL::variable& arguments)
+        {
+            check_quota();
+            if (script_engine *engine = script_engine::current())
+            {
+                engine->flush_writes();
+                engine->invalidate_reads(m_pDispatch);
+            }
+            counter_.stats().add(APSL_COUNTER_HOST_CALLS);
+            profile_frame frame(name_.c_str());
+            size_t length = arguments.length();
+            util::variant_array variant_arg(length);
+            for (size_t i = 0; i < length; ++i)
+                variant_arg.set(i, variable_to_variant(arguments[length - i - 1]));
+            DISPPARAMS params = {variant_arg.data(), NULL, UINT(length), 0};
+            host_result result;
+            if (FAILED(invoke_host(m_pDispatch, m_dispid, DISPATCH_METHOD, params, result)))
+                raise_host_error(result, name_.c_str()); // calling nothing is an error
+            return variant_to_variable(result.value.get());
+        }
+
+        PSL::variable * get_value_impl()
+        {
+            check_quota();
+            script_engine *engine = script_engine::current();
+            if (engine)
+                engine->flush_writes(m_pDispatch);
+            bool const idempotent = engine && engine->read_caching()
+                && (engine->member_flags(name_.c_str()) & APSL_MEMBER_IDEMPOTENT_GET);
+            if (idempotent)
+            {
+                if (VARIANT const *value = engine->cached_read(m_pDispatch, m_dispid))
+                {
+                    counter_.stats().add(APSL_COUNTER_READ_CACHE_HITS);
+                    return variant_to_variable(*value);
+                }
+            }
+            counter_.stats().add(APSL_COUNTER_HOST_PROPERTY_GETS);
+            profile_frame frame(name_.c_str());
+            DISPPARAMS params = {NULL, NULL, 0, 0};
+            host_result result;
+            invoke_host(m_pDispatch, m_dispid, DISPATCH_PROPERTYGET, params, result);
+            if (idempotent && SUCCEEDED(result.hr))
+                engine->cache_read(m_pDispatch, m_dispid, result.value.get());
+            return host_value(result, name_.c_str());
+        }
+
+        PSL::variable * assign_impl(PSL::variable& rhs)
+        {
+            check_quota();
+            if (script_engine *engine = script_engine::current())
+                engine->invalidate_reads(m_pDispatch);
+            if (defer_put(m_pDispatch, m_dispid, name_.c_str(), rhs))
+                return rhs;
+            counter_.stats().add(APSL_COUNTER_HOST_PROPERTY_PUTS);
+            profile_frame frame(name_.c_str());
+            util::scoped_variant value = variable_to_variant(rhs);
+            host_result result;
+            if (FAILED(put_property(m_pDispatch, m_dispid, value.get(), result)))
+                raise_host_error(result, name_.c_str());
+            return rhs;
+        }
+
+    private:
+        IDispatch *m_pDispatch;
+        DISPID m_dispid;
+        std::string name_;
+        wrapper_counter counter_;
+    };
+
+
+    class name_registry;
+
+    //////////////////////////////////////////////////////////////////////////
+    //
+    //  @class host_names
+    //  @brief what an engine has learned of one host object's members
+    //
+    //  Shared by every live wrapper of the object, so a name the host
+    //  rejected and the expando a script made of it are seen by all of
+    //  them.  Rejected names are kept as DISPID_UNKNOWN.  Refcounted by
+    //  the wrappers alone; the last release takes the entry out of the
+    //  engine's registry, and a wrapper may outlive its engine.
+    //
+    class host_names
+    {
+    public:
+        explicit host_names(IDispatch *pdisp) throw()
+        : refcount_(1)
+        , generation_(0)
+        , registry_(NULL)
+        , identity_(NULL)
+        , expandos_(static_cast<void *>(pdisp)) // holds members like a wrapper
+        {
+        }
+
+        void add_ref() throw()
+        {
+            InterlockedIncrement(&refcount_);
+        }
+
+        void release() throw();
+
+        // forgets the DISPIDs once the engine's names have been invalidated
+        void sync(LONG generation) throw()
+        {
+            if (generation_ == generation)
+                return;
+            dispids_.clear();
+            generation_ = generation;
+        }
+
+        bool find(char const *name, DISPID *pdispid) const
+        {
+            dispid_map::const_iterator it = dispids_.find(name);
+            if (it == dispids_.end())
+                return false;
+            return *pdispid = it->second, true;
+        }
+
+        void insert(char const *name, DISPID dispid)
+        {
+            dispids_[name] = dispid;
+        }
+
+        PSL::variable& expandos() throw()
+        {
+            return expandos_;
+        }
+
+    private:
+        friend class name_registry;
+        typedef std::map<std::string, DISPID> dispid_map;
+
+        ~host_names() throw()
+        {
+        }
+
+        host_names(host_names const&);
+        host_names& operator = (host_names const&);
+
+        LONG volatile refcount_;
+        LONG generation_;
+        name_registry *registry_;
+        IUnknown *identity_;
+        dispid_map dispids_;
+        PSL::variable expandos_;
+    };
+
+    //////////////////////////////////////////////////////////////////////////
+    //
+    //  @class name_registry
+    //  @brief the host_names of every host object an engine has wrapped
+    //
+    //  Keyed by the object's IUnknown identity, so every interface pointer
+    //  and every wrapper of one object share their names.  Entries are
+    //  weak: they hold no reference on the object and go with its last
+    //  wrapper, which does.  So the registry only ever holds objects the
+    //  script can still reach, and a freed pointer reused by another
+    //  object can never find a stale entry.
+    //
+    class name_registry
+    {
+    public:
+        name_registry() throw()
+        : generation_(0)
+        {
+        }
+
+        // wrappers that outlive the engine keep their names to themselves
+        ~name_registry() throw()
+        {
+            for (entry_map::iterator it = entries_.begin(); it != entries_.end(); ++it)
+                it->second->registry_ = NULL;
+        }
+
+        // a new reference to the names of pdisp's object
+        host_names *find(IDispatch *pdisp)
+        {
+            IUnknown *identity = NULL;
+            if (FAILED(pdisp->QueryInterface(IID_IUnknown, (void **)&identity)) || !identity)
+                return new host_names(pdisp); // nothing to share them under
+            identity->Release(); // pdisp keeps the object alive
+            entry_map::iterator it = entries_.find(identity);
+            if (it != entries_.end())
+            {
+                it->second->add_ref();
+                return it->second;
+            }
+            host_names *names = new host_names(pdisp);
+            try {
+                entries_.insert(std::make_pair(identity, names));
+            }
+            catch (...) {
+                names->release();
+                throw;
+            }
+            names->registry_ = this;
+            names->identity_ = identity;
+            return names;
+        }
+
+        void invalidate() throw()
+        {
+            ++generation_;
+        }
+
+        LONG generation() const throw()
+        {
+            return generation_;
+        }
+
+    private:
+        friend class host_names;
+        typedef std::map<IUnknown *, host_names *> entry_map;
+
+        name_registry(name_registry const&);
+        name_registry& operator = (name_registry const&);
+
+        void remove(IUnknown *identity) throw()
+        {
+            entries_.erase(identity);
+        }
+
+        entry_map entries_;
+        LONG generation_;
+    };
+
+    inline void host_names::release() throw()
+    {
+        if (0 != InterlockedDecrement(&refcount_))
+            return;
+        if (registry_)
+            registry_->remove(identity_);
+        delete this;
+    }
+
+
+    //////////////////////////////////////////////////////////////////////////
+    //
+    //  @class activex_object
+    //
+    class activex_object: public PSL::variable
+    {
+    public:
+        explicit activex_object(LPDISPATCH pdisp) throw()
+        : PSL::variable(pdisp)
+        , m_pDispatch(pdisp)
+        , names_(NULL)
+        {
+            APSL_ASSERT (NULL != m_pDispatch);
+            m_pDispatch->AddRef();
+        }
+
+        virtual ~activex_object() throw()
+        {
+            if (names_)
+                names_->release();
+            m_pDispatch->Release();
+        }
+
+        PSL::variable * __stdcall get__(PSL::string const& key)
+        {
+            return get_impl(key);
+        }
+
+        void __stdcall put__(PSL::string const& key, PSL::variable *rhs)
+        {
+            put_impl(key, rhs);
+        }
+
+    private:
+        // the engine's names of this object, looked up on first use
+        host_names& names()
+        {
+            script_engine *engine = script_engine::current();
+            if (!names_)
+                names_ = engine ? engine->names_of(m_pDispatch): new host_names(m_pDispatch);
+            if (engine)
+                names_->sync(engine->names_generation());
+            return *names_;
+        }
+
+        // Names the host rejected are remembered as DISPID_UNKNOWN, so a
+        // script's own expando members are resolved without a round trip.
+        HRESULT get_dispid(PSL::string const& key, DISPID *pdispid)
+        {
+            engine_stats& stats = counter_.stats();
+            stats.add(APSL_COUNTER_DISPID_LOOKUPS);
+            host_names& names = this->names();
+            if (names.find(key.c_str(), pdispid))
+            {
+                if (DISPID_UNKNOWN == *pdispid)
+                {
+                    stats.add(APSL_COUNTER_NEGATIVE_CACHE_HITS);
+                    return DISP_E_UNKNOWNNAME;
+                }
+                stats.add(APSL_COUNTER_DISPID_CACHE_HITS);
+                return S_OK;
+            }
+            stats.add(APSL_COUNTER_DISPID_CACHE_MISSES);
+            std::wstring name = util::widen(key.c_str());
+            LPOLESTR rgszNames = &name[0];
+            HRESULT hr = m_pDispatch->GetIDsOfNames(
+                IID_NULL, &rgszNames, 1, LOCALE_USER_DEFAULT, pdispid);
+            if (S_OK == hr)
+                names.insert(key.c_str(), *pdispid);
+            else if (DISP_E_UNKNOWNNAME == hr || DISP_E_MEMBERNOTFOUND == hr)
+                names.insert(key.c_str(), DISPID_UNKNOWN), hr = DISP_E_UNKNOWNNAME;
+            return hr;
+        }
+
+        PSL::variable *get_impl(PSL::string const& key)
+        {
+            check_quota();
+            if (script_engine *engine = script_engine::current())
+                engine->flush_writes(m_pDispatch);
+            DISPID rgDispid = 0;
+            HRESULT hr = get_dispid(key, &rgDispid);
+            if (hr == DISP_E_UNKNOWNNAME)
+                return names_->expandos().operator [] (key);
+            if (SUCCEEDED(hr))
+                return new runtime_callable_wrapper(m_pDispatch, rgDispid, key.c_str());
+            host_result result;
+            result.hr = hr;
+            raise_host_error(result, key.c_str());
+        }
+
+     private:
+        void put_impl(PSL::string const& key, PSL::variable *rhs)
+        {
+            check_quota();
+            DISPID rgDispid = 0;
+            HRESULT hr = get_dispid(key, &rgDispid);
+            if (hr == DISP_E_UNKNOWNNAME)
+                return names_->expandos().put__(key, rhs);
+            host_result result;
+            if (hr != S_OK)
+            {
+                result.hr = hr;
+                raise_host_error(result, key.c_str());
+            }
+            if (script_engine *engine = script_engine::current())
+                engine->invalidate_reads(m_pDispatch);
+            if (defer_put(m_pDispatch, rgDispid, key.c_str(), *rhs))
+                return;
+            counter_.stats().add(APSL_COUNTER_HOST_PROPERTY_PUTS);
+            profile_frame frame(key.c_str());
+            util::scoped_variant value = variable_to_variant(*rhs);
+            if (FAILED(put_property(m_pDispatch, rgDispid, value.get(), result)))
+                raise_host_error(result, key.c_str());
+        }
+
+     private:
+        IDispatch *m_pDispatch;
+        host_names *names_;
+        wrapper_counter counter_;
+    };
+
+
+    //////////////////////////////////////////////////////////////////////////
+    //
+    //  VARIANT -> PSL::variable
+    //
+    //  One converter per VARTYPE, instantiated from vartype_traits and
+    //  picked by a table lookup.  PSL has int and double only, so integers
+    //  outside the int range become doubles; no type goes through a string
+    //  unless it is one.
+    //
+    namespace from_variant {
+
+        inline PSL::variable *number(int x)
+        {
+            return new PSL::variable(x);
+        }
+
+        inline PSL::variable *number(double x)
+        {
+            return new PSL::variable(x);
+        }
+
+        inline PSL::variable *number(long x)
+        {
+            return number(int(x));
+        }
+
+        inline PSL::variable *number(float x)
+        {
+            return number(double(x));
+        }
+
+        inline PSL::variable *number(LONGLONG x)
+        {
+            if (x < INT_MIN || INT_MAX < x)
+                return number(double(x));
+            return number(int(x));
+        }
+
+        inline PSL::variable *number(ULONGLONG x)
+        {
+            if (INT_MAX < x)
+                return number(double(x));
+            return number(int(x));
+        }
+
+        inline PSL::variable *number(unsigned int x)
+        {
+            return number(ULONGLONG(x));
+        }
+
+        inline PSL::variable *number(unsigned long x)
+        {
+            return number(ULONGLONG(x));
+        }
+
+        typedef PSL::variable *(*converter)(VARIANT const& v);
+
+        PSL::variable *convert(VARIANT const& v);
+
+        template <VARTYPE VT>
+        PSL::variable *numeric(VARIANT const& v)
+        {
+            return number(vartype_traits<VT>::read(v));
+        }
+
+        PSL::variable *nil(VARIANT const&)
+        {
+            return new PSL::variable; // NIL
+        }
+
+        PSL::variable *boolean(VARIANT const& v)
+        {
+            return number(vartype_traits<VT_BOOL>::read(v) == VARIANT_FALSE ? 0: 1);
+        }
+
+        PSL::variable *error(VARIANT const& v)
+        {
+            SCODE const scode = vartype_traits<VT_ERROR>::read(v);
+            if (DISP_E_PARAMNOTFOUND == scode)
+                return nil(v); // omitted optional argument
+            return number(LONG(scode));
+        }
+
+        PSL::variable *currency(VARIANT const& v)
+        {
+            LONGLONG const value = vartype_traits<VT_CY>::read(v).int64;
+            if (value % 10000 == 0)
+                return number(value / 10000);
+            return number(value / 10000.0);
+        }
+
+        PSL::variable *decimal(VARIANT const& v)
+        {
+            DECIMAL const value = vartype_traits<VT_DECIMAL>::read(v);
+            if (0 == value.scale && 0 == value.Hi32 && value.Lo64 <= ULONGLONG(LLONG_MAX))
+            {
+                LONGLONG const x = LONGLONG(value.Lo64);
+                return number(value.sign & DECIMAL_NEG ? -x: x);
+            }
+            double x = 0;
+            if (FAILED(VarR8FromDec(&value, &x)))
+                throw host_error(DISP_E_OVERFLOW, L"DECIMAL value out of range of a number");
+            return number(x);
+        }
+
+        PSL::variable *string(VARIANT const& v)
+        {
+            BSTR bstr = vartype_traits<VT_BSTR>::read(v);
+            if (!bstr)
+                return new PSL::variable("");
+            current_stats().add(APSL_COUNTER_BYTES_TRANSCODED, ::SysStringByteLen(bstr));
+            std::string str;
+            util::narrow(bstr, ::SysStringLen(bstr), str);
+            return new PSL::variable(PSL::string(str.c_str()));
+        }
+
+        PSL::variable *dispatch(VARIANT const& v)
+        {
+            IDispatch *pdisp = vartype_traits<VT_DISPATCH>::read(v);
+            if (!pdisp)
+                return nil(v);
+            return new aPSL::activex_object(pdisp);
+        }
+
+        PSL::variable *unknown(VARIANT const& v)
+        {
+            IUnknown *punk = vartype_traits<VT_UNKNOWN>::read(v);
+            IDispatch *pdisp = NULL;
+            if (!punk || FAILED(punk->QueryInterface(IID_IDispatch, (void **)&pdisp)))
+                return nil(v); // nothing a script can reach
+            PSL::variable *result = new aPSL::activex_object(pdisp);
+            pdisp->Release();
+            return result;
+        }
+
+        PSL::variable *variant(VARIANT const& v)
+        {
+            APSL_ASSERT(v.vt & VT_BYREF);
+            if (!(v.vt & VT_BYREF) || !v.pvarVal)
+                return nil(v);
+            return convert(*v.pvarVal);
+        }
+
+        // one-dimensional SAFEARRAYs become RARRAYs, element by element
+        PSL::variable *array(VARIANT const& v)
+        {
+            SAFEARRAY *psa = v.vt & VT_BYREF ? *v.pparray: v.parray;
+            VARTYPE const vt = v.vt & VT_TYPEMASK;
+            PSL::variable *result = new PSL::variable(PSL::variable::RARRAY);
+            if (!psa)
+                return result;
+            LONG lower = 0, upper = -1;
+            if (VT_RECORD == vt || 1 != SafeArrayGetDim(psa)
+                || FAILED(SafeArrayGetLBound(psa, 1, &lower))
+                || FAILED(SafeArrayGetUBound(psa, 1, &upper)))
+            {
+                APSL_ASSERT(0);
+                return result;
+            }
+            for (LONG i = lower; i <= upper; ++i)
+            {
+                util::scoped_variant element;
+                HRESULT hr;
+                if (VT_VARIANT == vt)
+                    hr = SafeArrayGetElement(psa, &i, &element.get());
+                else if (VT_DECIMAL == vt)
+                    hr = SafeArrayGetElement(psa, &i, &element.get().decVal);
+                else
+                    hr = SafeArrayGetElement(psa, &i, &element.get().lVal);
+                if (FAILED(hr))
+                {
+                    APSL_ASSERT(0);
+                    continue;
+                }
+                if (VT_VARIANT != vt)
+                    element.get().vt = vt; // after: DECIMAL overlaps vt
+                result->push(convert(element.get()));
+            }
+            return result;
+        }
+
+        PSL::variable *unsupported(VARIANT const& v)
+        {
+            APSL_ASSERT(0);
+            return nil(v);
+        }
+
+        converter const table[] = {
+            nil,                  // VT_EMPTY
+            nil,                  // VT_NULL
+            numeric<VT_I2>,       // VT_I2
+            numeric<VT_I4>,       // VT_I4
+            numeric<VT_R4>,       // VT_R4
+            numeric<VT_R8>,       // VT_R8
+            currency,             // VT_CY
+            numeric<VT_DATE>,     // VT_DATE (days since 1899-12-30)
+            string,               // VT_BSTR
+            dispatch,             // VT_DISPATCH
+            error,                // VT_ERROR
+            boolean,              // VT_BOOL
+            variant,              // VT_VARIANT
+            unknown,              // VT_UNKNOWN
+            decimal,              // VT_DECIMAL
+            unsupported,          // 15
+            numeric<VT_I1>,       // VT_I1
+            numeric<VT_UI1>,      // VT_UI1
+            numeric<VT_UI2>,      // VT_UI2
+            numeric<VT_UI4>,      // VT_UI4
+            numeric<VT_I8>,       // VT_I8
+            numeric<VT_UI8>,      // VT_UI8
+            numeric<VT_INT>,      // VT_INT
+            numeric<VT_UINT>,     // VT_UINT
+        };
+
+        PSL::variable *convert(VARIANT const& v)
+        {
+            current_stats().count_from_variant(v.vt);
+            if (v.vt & VT_ARRAY)
+                return array(v);
+            VARTYPE const vt = v.vt & VT_TYPEMASK;
+            if (vt < sizeof(table) / sizeof(table[0]))
+                return table[vt](v);
+            return unsupported(v);
+        }
+
+    } // namespace from_variant
+
+    PSL::variable * variant_to_variable(VARIANT const& v)
+    {
+        return from_variant::convert(v);
+    }
+
+    //////////////////////////////////////////////////////////////////////////
+    //
+    //  @fn enumerate_collection
+    //  @brief appends all elements of a host collection to an RARRAY
+    //
+    //  Walks the collection's DISPID_NEWENUM enumerator.  Each Next asks
+    //  for a block twice the size of the last one filled, from 16 up to
+    //  1024, so a large collection costs about log2(N/16) + N/1024 round
+    //  trips instead of one item() call per element.  Returns false when
+    //  the object cannot be enumerated; a Next that fails part-way raises
+    //  a host_error like any other host call.
+    //
+    //  The whole collection is materialised before the script sees it:
+    //  one PSL value per element plus a transient VARIANT block of up to
+    //  LAST_BLOCK entries.  The values stay resident for as long as the
+    //  array lives.  Scripts that only need a prefix of a large
+    //  collection should index it through item() instead.
+    //
+    bool enumerate_collection(IDispatch *pdisp, PSL::variable& items)
+    {
+        enum { FIRST_BLOCK = 16, LAST_BLOCK = 1024 };
+        if (!pdisp)
+            return false;
+        if (script_engine *engine = script_engine::current())
+            engine->flush_writes(pdisp);
+        engine_stats& stats = current_stats();
+
+        util::scoped_variant result;
+        {
+            util::scoped_excepinfo excepinfo;
+            UINT argerr = 0;
+            DISPPARAMS params = {NULL, NULL, 0, 0};
+            stats.add(APSL_COUNTER_HOST_CALLS);
+            HRESULT hr = pdisp->Invoke(
+                DISPID_NEWENUM, IID_NULL, LOCALE_USER_DEFAULT,
+                DISPATCH_METHOD | DISPATCH_PROPERTYGET,
+                &params, result.receive(), &excepinfo, &argerr);
+            if (FAILED(hr))
+                return false;
+        }
+        IUnknown *punk = NULL;
+        switch (result.get().vt)
+        {
+        case VT_UNKNOWN: punk = result.get().punkVal; break;
+        case VT_DISPATCH: punk = result.get().pdispVal; break;
+        }
+        IEnumVARIANT *penum = NULL;
+        if (!punk || FAILED(punk->QueryInterface(IID_IEnumVARIANT, (void **)&penum)))
+            return false;
+
+        try {
+            for (ULONG block = FIRST_BLOCK;;)
+            {
+                util::variant_array buffer(block);
+                ULONG fetched = 0;
+                stats.add(APSL_COUNTER_HOST_CALLS);
+                host_result next;
+                next.hr = penum->Next(block, buffer.data(), &fetched);
+                if (SUCCEEDED(next.hr) && fetched > block)
+                    next.hr = E_UNEXPECTED; // the enumerator overran the block
+                if (FAILED(next.hr))
+                    raise_host_error(next, "_NewEnum");
+                HRESULT const hr = next.hr;
+                stats.add(APSL_COUNTER_ENUM_ITEMS, fetched);
+                for (ULONG i = 0; i < fetched; ++i)
+                    items.push(variant_to_variable(buffer.data()[i]));
+                if (S_OK != hr || fetched < block)
+                    break;
+                if (block < LAST_BLOCK)
+                    block *= 2;
+            }
+        }
+        catch (...) {
+            penum->Release();
+            throw;
+        }
+        penum->Release();
+        return true;
+    }
+
+} // namespace aPSL
+
+
+namespace aPSL {
+
+    //////////////////////////////////////////////////////////////////////
+    //
+    //  @class scriptsite_object
+    //
+    class scriptsite_object 
+    : public PSL::variable
+    {
+    public:
+        explicit scriptsite_object(IActiveScriptSite *pActiveScriptSite)
+        : m_pActiveScriptSite(pActiveScriptSite)
+        {
+            APSL_ASSERT(NULL != m_pActiveScriptSite);
+            m_pActiveScriptSite->AddRef();
+        }
+    
+        virtual ~scriptsite_object() throw()
+        {
+            APSL_ASSERT(NULL != m_pActiveScriptSite);
+            m_pActiveScriptSite->Release();
+        }
+    
+        PSL::variable *get__(LPCOLESTR key)
+        {
+            LPDISPATCH pdisp = NULL;
+            HRESULT hr = get_member(key, &pdisp);
+            PSL::variable *result;
+            if (FAILED(hr) || NULL == pdisp)
+                result = new PSL::variable;
+            else
+            {
+                result = new aPSL::activex_object(pdisp);
+                pdisp->Release(); // the wrapper holds its own reference
+            }
+            result->ref();
+            return result;
+        }
+    
+        HRESULT get_member(LPCOLESTR key, LPDISPATCH *ppdisp)
+        {
+            LPOLESTR rgszNames = const_cast<LPOLESTR>(key);
+            DISPID rgDispid = 0;
+            HRESULT hr = S_OK;
+            IUnknown *pUnkown = NULL;
+            APSL_ASSERT(0 != m_pActiveScriptSite);
+            hr = m_pActiveScriptSite->GetItemInfo(
+                rgszNames, SCRIPTINFO_IUNKNOWN, &pUnkown, NULL);
+            if (FAILED(hr))
+                return hr;
+            hr = pUnkown->QueryInterface(
+                IID_IDispatch, reinterpret_cast<LPVOID*>(ppdisp));
+            pUnkown->Release();
+            return hr;
+        }
+    
+    private:
+        IActiveScriptSite *m_pActiveScriptSite;
+    };
+
+    //////////////////////////////////////////////////////////////////////
+    //
+    //  @var counter_names
+    //  @brief script visible names of the engine counters
+    //
+    static struct {
+        APSL_COUNTER counter;
+        char const *name;
+    } const counter_names[] = {
+        { APSL_COUNTER_HOST_CALLS, "hostCalls" },
+        { APSL_COUNTER_HOST_PROPERTY_GETS, "hostGets" },
+        { APSL_COUNTER_HOST_PROPERTY_PUTS, "hostPuts" },
+        { APSL_COUNTER_DISPID_LOOKUPS, "dispidLookups" },
+        { APSL_COUNTER_DISPID_CACHE_HITS, "dispidCacheHits" },
+        { APSL_COUNTER_DISPID_CACHE_MISSES, "dispidCacheMisses" },
+        { APSL_COUNTER_BYTES_TRANSCODED, "bytesTranscoded" },
+        { APSL_COUNTER_WRAPPERS_ALIVE, "wrappersAlive" },
+        { APSL_COUNTER_COMPILE_MICROSECONDS, "compileMicroseconds" },
+        { APSL_COUNTER_RUN_MICROSECONDS, "runMicroseconds" },
+        { APSL_COUNTER_GC_FLUSHES, "gcFlushes" },
+        { APSL_COUNTER_GC_MICROSECONDS, "gcMicroseconds" },
+        { APSL_COUNTER_NEGATIVE_CACHE_HITS, "negativeCacheHits" },
+        { APSL_COUNTER_DEFERRED_PUTS, "deferredPuts" },
+        { APSL_COUNTER_COALESCED_PUTS, "coalescedPuts" },
+        { APSL_COUNTER_TIMERS_RUN, "timersRun" },
+        { APSL_COUNTER_ENUM_ITEMS, "enumItems" },
+        { APSL_COUNTER_READ_CACHE_HITS, "readCacheHits" },
+        { APSL_COUNTER_FUNCTIONS_RELOADED, "functionsReloaded" },
+    };
+
+    //////////////////////////////////////////////////////////////////////
+    //
+    //  @class stats_object
+    //  @brief built-in script object exposing the engine counters
+    //
+    class stats_object
+    : public PSL::variable
+    {
+    public:
+        explicit stats_object(engine_stats& stats) throw()
+        : stats_(stats)
+        {
+            stats_.add_ref();
+        }
+
+        virtual ~stats_object() throw()
+        {
+            stats_.release();
+        }
+
+        PSL::variable * __stdcall get__(PSL::string const& key)
+        {
+            for (size_t i = 0; i < sizeof(counter_names) / sizeof(*counter_names); ++i)
+            {
+                if (0 != strcmp(key.c_str(), counter_names[i].name))
+                    continue;
+                ULONGLONG const value = stats_.get(counter_names[i].counter);
+                if (value <= INT_MAX)
+                    return new PSL::variable(int(value));
+                return new PSL::variable(double(value));
+            }
+            return new PSL::variable; // NIL
+        }
+
+    private:
+        stats_object& operator = (stats_object const&);
+
+        engine_stats& stats_;
+    };
+
+    //////////////////////////////////////////////////////////////////////
+    //
+    //  @struct prepared_script::body
+    //
+    struct prepared_script::body
+    {
+        body(DWORD cookie, ULONG line)
+        : refcount(1), cookie(cookie), line(line)
+        {
+        }
+
+        LONG refcount;
+        std::string text;
+        DWORD cookie;
+        ULONG line;
+    };
+
+    // body_ is set last so a throwing copy or transcode frees the body
+    prepared_script::prepared_script(char const *text, DWORD cookie, ULONG line)
+    : body_(NULL)
+    {
+        std::auto_ptr<body> guard(new body(cookie, line));
+        guard->text = text;
+        body_ = guard.release();
+    }
+
+    prepared_script::prepared_script(LPCOLESTR text, DWORD cookie, ULONG line)
+    : body_(NULL)
+    {
+        std::auto_ptr<body> guard(new body(cookie, line));
+        size_t const length = text ? wcslen(text): 0;
+        current_stats().add(APSL_COUNTER_BYTES_TRANSCODED, length * sizeof(OLECHAR));
+        util::narrow(text, length, guard->text);
+        body_ = guard.release();
+    }
+
+    prepared_script::prepared_script(prepared_script const& other) throw()
+    : body_(other.body_)
+    {
+        InterlockedIncrement(&body_->refcount);
+    }
+
+    prepared_script& prepared_script::operator = (prepared_script const& other) throw()
+    {
+        InterlockedIncrement(&other.body_->refcount);
+        if (0 == InterlockedDecrement(&body_->refcount))
+            delete body_;
+        body_ = other.body_;
+        return *this;
+    }
+
+    prepared_script::~prepared_script() throw()
+    {
+        if (0 == InterlockedDecrement(&body_->refcount))
+            delete body_;
+    }
+
+    char const *prepared_script::text() const throw()
+    {
+        return body_->text.c_str();
+    }
+
+    size_t prepared_script::length() const throw()
+    {
+        return body_->text.length();
+    }
+
+    DWORD prepared_script::cookie() const throw()
+    {
+        return body_->cookie;
+    }
+
+    ULONG prepared_script::line() const throw()
+    {
+        return body_->line;
+    }
+
+    //////////////////////////////////////////////////////////////////////
+    //
+    //  @struct source_definition
+    //  @brief one top-level function definition of a script block
+    //
+    //  A definition has the form "[function] name(...) {...}" and starts
+    //  where a top-level statement may: at the start of the block, after
+    //  ';' or '}', or on a new line when the previous one did not end in
+    //  an operator, ',' or an open bracket.  It ends at its closing brace,
+    //  so bodies, headers and arguments may span any number of lines.
+    //
+    struct source_definition
+    {
+        size_t begin;
+        size_t end;
+        ULONG line;
+        ULONG end_line;
+        std::string name;
+    };
+
+    namespace source_scan {
+
+        inline bool identifier_char(char c) throw()
+        {
+            return c == '_' || ('0' <= c && c <= '9')
+                || ('a' <= c && c <= 'z') || ('A' <= c && c <= 'Z')
+                || 0 != (c & 0x80); // lead and trail bytes
+        }
+
+        inline bool keyword(std::string const& name) throw()
+        {
+            static char const *const keywords[] = {
+                "if", "while", "for", "foreach", "switch", "catch", "return", "yield",
+            };
+            for (size_t i = 0; i < sizeof(keywords) / sizeof(*keywords); ++i)
+                if (name == keywords[i])
+                    return true;
+            return false;
+        }
+
+        // a line ending in c goes on with the next one
+        inline bool continues(char c) throw()
+        {
+            return 0 != c && 0 != strchr("+-*/%=<>!&|^~?:,.([", c);
+        }
+
+        // skips a string literal or comment starting at i, if any
+        inline size_t skip_literal(char const *text, size_t length, size_t i) throw()
+        {
+            char const c = text[i];
+            if ('"' == c || '\'' == c)
+            {
+                for (++i; i < length && text[i] != c; ++i)
+                    if ('\\' == text[i])
+                        ++i;
+                return i < length ? i + 1: length;
+            }
+            if ('/' == c && i + 1 < length && '/' == text[i + 1])
+            {
+                while (i < length && '\n' != text[i])
+                    ++i;
+                return i;
+            }
+            if ('/' == c && i + 1 < length && '*' == text[i + 1])
+            {
+                for (i += 2; i + 1 < length; ++i)
+                    if ('*' == text[i] && '/' == text[i + 1])
+                        return i + 2;
+                return length;
+            }
+            return i;
+        }
+
+        inline size_t skip_blank(char const *text, size_t length, size_t i) throw()
+        {
+            for (;;)
+            {
+                while (i < length && (' ' == text[i] || '\t' == text[i]
+                                      || '\r' == text[i] || '\n' == text[i]))
+                    ++i;
+                size_t const next = i < length && '/' == text[i]
+                    ? skip_literal(text, length, i): i;
+                if (next == i)
+                    return i;
+                i = next;
+            }
+        }
+
+        inline size_t identifier(char const *text, size_t end, size_t i, std::string *name)
+        {
+            size_t const first = i;
+            while (i < end && identifier_char(text[i]))
+                ++i;
+            if (name)
+                name->assign(text + first, i - first);
+            return i;
+        }
+
+        // the end of the bracketed group opening at i, or 0 when it is
+        // never closed
+        inline size_t skip_group(char const *text, size_t length, size_t i) throw()
+        {
+            char const open = text[i], close = '(' == open ? ')': '}';
+            for (int depth = 0; i < length; )
+            {
+                size_t const skipped = skip_literal(text, length, i);
+                if (skipped != i)
+                {
+                    i = skipped;
+                    continue;
+                }
+                if (open == text[i])
+                    ++depth;
+                else if (close == text[i] && 0 == --depth)
+                    return i + 1;
+                ++i;
+            }
+            return 0;
+        }
+
+        // the end of a definition starting at i, or i when there is none
+        inline size_t definition(char const *text, size_t length, size_t i, std::string& name)
+        {
+            size_t next = identifier(text, length, i, &name);
+            if ("function" == name)
+                next = identifier(text, length, skip_blank(text, length, next), &name);
+            if (name.empty() || ('0' <= name[0] && name[0] <= '9') || keyword(name))
+                return i;
+            next = skip_blank(text, length, next);
+            if (next >= length || '(' != text[next])
+                return i;
+            if (0 == (next = skip_group(text, length, next)))
+                return i;
+            next = skip_blank(text, length, next);
+            if (next >= length || '{' != text[next])
+                return i;
+            size_t const end = skip_group(text, length, next);
+            return end ? end: i;
+        }
+
+    } // namespace source_scan
+
+    // the top-level definitions of text, in order; line is that of text[0]
+    inline void find_definitions(char const *text, size_t length, ULONG line,
+                                 std::vector<source_definition>& definitions)
+    {
+        using namespace source_scan;
+        definitions.clear();
+        int depth = 0;
+        char last = 0;              // last character that is not blank
+        bool start = true;          // a statement may start here
+        for (size_t i = 0; i < length; )
+        {
+            char const c = text[i];
+            if (' ' == c || '\t' == c || '\r' == c || '\n' == c)
+            {
+                if ('\n' == c)
+                {
+                    ++line;
+                    if (0 == depth && !continues(last))
+                        start = true;
+                }
+                ++i;
+                continue;
+            }
+            size_t const skipped = skip_literal(text, length, i);
+            if (skipped != i)
+            {
+                for (size_t j = i; j < skipped; ++j)
+                    if ('\n' == text[j])
+                        ++line;
+                if ('/' != c) // a comment changes nothing
+                    last = c, start = false;
+                i = skipped;
+                continue;
+            }
+            if (start && 0 == depth && identifier_char(c))
+            {
+                source_definition d;
+                size_t const end = definition(text, length, i, d.name);
+                if (end != i)
+                {
+                    d.begin = i;
+                    d.end = end;
+                    d.line = line;
+                    for (size_t j = i; j < end; ++j)
+                        if ('\n' == text[j])
+                            ++line;
+                    d.end_line = line;
+                    definitions.push_back(d);
+                    i = end;
+                    last = '}';
+                    continue;
+                }
+            }
+            if ('(' == c || '[' == c || '{' == c)
+                ++depth;
+            else if (')' == c || ']' == c || '}' == c)
+                depth = depth > 0 ? depth - 1: 0;
+            last = c;
+            start = 0 == depth && (';' == c || '}' == c);
+            ++i;
+        }
+    }
+
+    // the text of a block outside its definitions, one trimmed line per
+    // line that is not blank, so that moving code about does not count
+    inline std::string statements(char const *text, size_t length,
+                                  std::vector<source_definition> const& definitions)
+    {
+        std::string result;
+        size_t from = 0;
+        for (size_t d = 0; d <= definitions.size(); ++d)
+        {
+            size_t const to = d < definitions.size() ? definitions[d].begin: length;
+            for (size_t i = from; i < to; )
+            {
+                size_t end = i;
+                while (end < to && '\n' != text[end])
+                    ++end;
+                size_t first = i, last = end;
+                while (first < last && strchr(" \t\r", text[first]))
+                    ++first;
+                while (last > first && strchr(" \t\r", text[last - 1]))
+                    --last;
+                if (first < last)
+                    result.append(text + first, last - first).append(1, '\n');
+                i = end + 1;
+            }
+            if (d < definitions.size())
+                from = definitions[d].end;
+        }
+        return result;
+    }
+
+    //////////////////////////////////////////////////////////////////////
+    //
+    //  @struct source_diff
+    //  @brief what turns the last version of a block into the next
+    //
+    //  text holds the definitions that are new or differ, each on the
+    //  line it has in the new version counting from line, so one load
+    //  compiles them all and errors still point at the right lines.
+    //  complete is false when anything outside the definitions changed or
+    //  a definition was removed; neither can be undone in a live engine.
+    //
+    struct source_diff
+    {
+        source_diff()
+        : line(0), definitions(0), complete(true)
+        {
+        }
+
+        std::string text;
+        ULONG line;
+        size_t definitions;
+        bool complete;
+    };
+
+    inline void diff_sources(prepared_script const& before, prepared_script const& after,
+                             source_diff& diff)
+    {
+        std::vector<source_definition> old_definitions, new_definitions;
+        find_definitions(before.text(), before.length(), before.line(), old_definitions);
+        find_definitions(after.text(), after.length(), after.line(), new_definitions);
+
+        std::map<std::string, std::string> previous;
+        for (size_t i = 0; i < old_definitions.size(); ++i)
+            previous[old_definitions[i].name].assign(
+                before.text() + old_definitions[i].begin,
+                old_definitions[i].end - old_definitions[i].begin);
+
+        diff = source_diff();
+        ULONG line = 0;
+        for (size_t i = 0; i < new_definitions.size(); ++i)
+        {
+            source_definition const& d = new_definitions[i];
+            char const *const text = after.text() + d.begin;
+            size_t const length = d.end - d.begin;
+            std::map<std::string, std::string>::iterator const it = previous.find(d.name);
+            if (previous.end() != it)
+            {
+                bool const unchanged = it->second.size() == length
+                    && 0 == it->second.compare(0, length, text, length);
+                previous.erase(it);
+                if (unchanged)
+                    continue;
+            }
+            if (0 == diff.definitions++)
+                diff.line = line = d.line;
+            diff.text.append(d.line - line, '\n').append(text, length);
+            line = d.end_line;
+        }
+        diff.complete = previous.empty()
+            && statements(before.text(), before.length(), old_definitions)
+                == statements(after.text(), after.length(), new_definitions);
+    }
+
+    //////////////////////////////////////////////////////////////////////
+    //
+    //  @class write_queue
+    //  @brief property puts held back per host object
+    //
+    //  A later put to the same member replaces the queued one and moves
+    //  to the end, so a flush replays the final writes in the order the
+    //  script made them.  A put the host refuses does not stop the rest;
+    //  the first refusal is raised once they are all delivered.
+    //
+    class write_queue
+    {
+    public:
+        write_queue() throw()
+        {
+        }
+
+        ~write_queue() throw()
+        {
+            APSL_ASSERT(objects_.empty());
+        }
+
+        bool empty() const throw()
+        {
+            return objects_.empty();
+        }
+
+        void push(IDispatch *pdisp, DISPID dispid, char const *name, VARIANT& value,
+                  engine_stats& stats)
+        {
+            stats.add(APSL_COUNTER_DEFERRED_PUTS);
+            pending_object *object = find(pdisp);
+            if (!object)
+            {
+                objects_.push_back(pending_object(pdisp));
+                object = &objects_.back();
+            }
+            for (size_t i = 0; i < object->puts.size(); ++i)
+            {
+                if (object->puts[i].dispid != dispid)
+                    continue;
+                stats.add(APSL_COUNTER_COALESCED_PUTS);
+                VariantClear(&object->puts[i].value);
+                object->puts.erase(object->puts.begin() + i);
+                break;
+            }
+            object->puts.push_back(pending_put(dispid, name, value));
+            value.vt = VT_EMPTY; // moved into the queue
+        }
+
+        // throws host_error for the first put the host refused
+        void flush(IDispatch *pdisp, engine_stats& stats)
+        {
+            host_result failure;
+            std::string failed_name;
+            for (size_t i = 0; i < objects_.size();)
+            {
+                if (pdisp && objects_[i].pdisp != pdisp)
+                {
+                    ++i;
+                    continue;
+                }
+                pending_object object = objects_[i];
+                objects_.erase(objects_.begin() + i);
+                for (size_t j = 0; j < object.puts.size(); ++j)
+                {
+                    pending_put& put = object.puts[j];
+                    stats.add(APSL_COUNTER_HOST_PROPERTY_PUTS);
+                    try {
+                        host_result result;
+                        if (FAILED(put_property(object.pdisp, put.dispid, put.value, result))
+                            && SUCCEEDED(failure.hr))
+                        {
+                            failure.hr = result.hr;
+                            failure.description.swap(result.description);
+                            failed_name.swap(put.name);
+                        }
+                    }
+                    catch (...) {
+                        if (SUCCEEDED(failure.hr))
+                            failure.hr = E_OUTOFMEMORY;
+                    }
+                    VariantClear(&put.value);
+                }
+                object.pdisp->Release();
+            }
+            if (FAILED(failure.hr))
+                raise_host_error(failure, failed_name.c_str());
+        }
+
+    private:
+        struct pending_put
+        {
+            pending_put(DISPID dispid, char const *name, VARIANT const& value)
+            : dispid(dispid), name(name), value(value)
+            {
+            }
+
+            DISPID dispid;
+            std::string name;
+            VARIANT value;
+        };
+
+        struct pending_object
+        {
+            explicit pending_object(IDispatch *pdisp)
+            : pdisp(pdisp)
+            {
+                pdisp->AddRef();
+            }
+
+            IDispatch *pdisp;
+            std::vector<pending_put> puts;
+        };
+
+        pending_object *find(IDispatch *pdisp) throw()
+        {
+            for (size_t i = 0; i < objects_.size(); ++i)
+                if (objects_[i].pdisp == pdisp)
+                    return &objects_[i];
+            return NULL;
+        }
+
+        write_queue(write_queue const&);
+        write_queue& operator = (write_queue const&);
+
+        std::vector<pending_object> objects_;
+    };
+
+    //////////////////////////////////////////////////////////////////////
+    //
+    //  @class read_cache
+    //  @brief host property values already read during this run
+    //
+    //  Entries hold a reference on their object, so a pointer freed and
+    //  reused by another object within the run can never hit.
+    //
+    class read_cache
+    {
+    public:
+        read_cache() throw()
+        {
+        }
+
+        ~read_cache() throw()
+        {
+            clear(NULL);
+        }
+
+        bool empty() const throw()
+        {
+            return entries_.empty();
+        }
+
+        VARIANT const *find(IDispatch *pdisp, DISPID dispid) const throw()
+        {
+            entry_map::const_iterator it = entries_.find(std::make_pair(pdisp, dispid));
+            return it == entries_.end() ? NULL: &it->second;
+        }
+
+        void insert(IDispatch *pdisp, DISPID dispid, VARIANT const& value)
+        {
+            util::scoped_variant copy;
+            if (FAILED(VariantCopy(copy.receive(), const_cast<VARIANT *>(&value))))
+                return;
+            std::pair<entry_map::iterator, bool> const inserted
+                = entries_.insert(std::make_pair(std::make_pair(pdisp, dispid), VARIANT()));
+            if (!inserted.second)
+                VariantClear(&inserted.first->second);
+            else
+                pdisp->AddRef();
+            inserted.first->second = copy.detach();
+        }
+
+        // entries of pdisp, or all of them when pdisp is NULL
+        void clear(IDispatch *pdisp) throw()
+        {
+            entry_map::iterator first = entries_.begin(), last = entries_.end();
+            if (pdisp)
+            {
+                first = entries_.lower_bound(std::make_pair(pdisp, DISPID(LONG_MIN)));
+                last = entries_.upper_bound(std::make_pair(pdisp, DISPID(LONG_MAX)));
+            }
+            for (entry_map::iterator it = first; it != last; ++it)
+            {
+                VariantClear(&it->second);
+                it->first.first->Release();
+            }
+            entries_.erase(first, last);
+        }
+
+    private:
+        typedef std::map<std::pair<IDispatch *, DISPID>, VARIANT> entry_map;
+
+        read_cache(read_cache const&);
+        read_cache& operator = (read_cache const&);
+
+        entry_map entries_;
+    };
+
+    //////////////////////////////////////////////////////////////////////
+    //
+    //  @class timer_wheel
+    //  @brief hierarchical timing wheel of script callbacks
+    //
+    //  Four levels of 256 slots at one millisecond resolution.  A timer
+    //  sits in the lowest level whose span covers its delay and moves
+    //  down as the wheel turns.  Timers are slab entries linked by index
+    //  within their slot, so insert and cancel are O(1); ids carry a
+    //  generation so a stale id never cancels a reused entry.
+    //
+    class timer_wheel
+    {
+    public:
+        enum { LEVEL_BITS = 8, LEVELS = 4, SLOTS = 1 << LEVEL_BITS };
+
+        timer_wheel()
+        : now_(milliseconds())
+        , free_(NIL)
+        , pending_(0)
+        {
+            for (size_t i = 0; i < LEVELS * SLOTS; ++i)
+                heads_[i] = NIL;
+        }
+
+        ~timer_wheel() throw()
+        {
+            for (size_t i = 0; i < entries_.size(); ++i)
+                delete entries_[i].callback;
+        }
+
+        int add(PSL::variable const& callback, ULONG delay, ULONG period)
+        {
+            PSL::variable *copy = new PSL::variable(callback);
+            LONG index;
+            try {
+                index = allocate();
+            }
+            catch (...) {
+                delete copy;
+                throw;
+            }
+            entry& e = entries_[index];
+            e.callback = copy;
+            e.period = period;
+            e.state = PENDING;
+            // the wheel may lag the clock until the host pumps it
+            ULONGLONG const now = milliseconds();
+            link(index, (now_ < now ? now: now_) + (delay ? delay: 1));
+            return id(index);
+        }
+
+        bool cancel(int timer) throw()
+        {
+            LONG const index = timer & INDEX_MASK;
+            if (index < 0 || entries_.size() <= size_t(index))
+                return false;
+            entry& e = entries_[index];
+            if (id(index) != timer)
+                return false;
+            switch (e.state)
+            {
+            case PENDING:
+                unlink(index);
+                release(index);
+                return true;
+            case RUNNING:
+                e.state = CANCELLED; // released once its callback returns
+                return true;
+            default:
+                return false;
+            }
+        }
+
+        // turns the wheel to the current time and runs what came due;
+        // timers added by the callbacks wait for the next call, and those
+        // they cancel never run
+        size_t run_due()
+        {
+            ULONGLONG const target = milliseconds();
+            std::vector<LONG> due;
+            while (now_ < target)
+            {
+                if (0 == pending_)
+                {
+                    now_ = target;
+                    break;
+                }
+                ++now_;
+                cascade();
+                LONG& head = heads_[now_ & (SLOTS - 1)];
+                while (NIL != head)
+                {
+                    LONG const index = head;
+                    unlink(index);
+                    entries_[index].state = RUNNING;
+                    due.push_back(index);
+                }
+            }
+            size_t run = 0;
+            for (size_t i = 0; i < due.size(); ++i)
+            {
+                LONG const index = due[i];
+                if (RUNNING != entries_[index].state)
+                {
+                    release(index); // cancelled by an earlier callback
+                    continue;
+                }
+                ++run;
+                try {
+                    PSL::variable callback = *entries_[index].callback;
+                    PSL::variable arguments(PSL::variable::RARRAY);
+                    quota_scope enforce;
+                    callback(arguments);
+                }
+                catch (...) {
+                    // the rest run on the next call; this one is dropped
+                    for (size_t j = i + 1; j < due.size(); ++j)
+                    {
+                        if (RUNNING != entries_[due[j]].state)
+                        {
+                            release(due[j]);
+                            continue;
+                        }
+                        entries_[due[j]].state = PENDING;
+                        link(due[j], now_ + 1);
+                    }
+                    release(index);
+                    throw;
+                }
+                entry& e = entries_[index];
+                if (RUNNING == e.state && e.period)
+                {
+                    e.state = PENDING;
+                    link(index, now_ + e.period);
+                }
+                else
+                {
+                    release(index);
+                }
+            }
+            return run;
+        }
+
+        // milliseconds until the earliest timer could be due; the wheel
+        // only knows slots, so upper levels answer with their slot start
+        ULONG next_due() const throw()
+        {
+            if (0 == pending_)
+                return INFINITE;
+            ULONGLONG const now = milliseconds();
+            for (ULONGLONG tick = now_ + 1; tick <= now_ + SLOTS; ++tick)
+            {
+                if (NIL != heads_[tick & (SLOTS - 1)])
+                    return tick <= now ? 0: ULONG(tick - now);
+            }
+            ULONGLONG const next = (now_ | (SLOTS - 1)) + 1;
+            return next <= now ? 0: ULONG(next - now);
+        }
+
+        size_t pending() const throw()
+        {
+            return pending_;
+        }
+
+    private:
+        enum state_t { FREE, PENDING, RUNNING, CANCELLED };
+        enum { NIL = -1, INDEX_BITS = 20, INDEX_MASK = (1 << INDEX_BITS) - 1 };
+
+        struct entry
+        {
+            entry()
+            : callback(NULL), due(0), period(0), state(FREE), generation(0)
+            , prev(NIL), next(NIL)
+            {
+            }
+
+            PSL::variable *callback;
+            ULONGLONG due;
+            ULONG period;
+            state_t state;
+            LONG generation;
+            LONG prev;
+            LONG next;
+        };
+
+        static ULONGLONG milliseconds() throw()
+        {
+            return util::ticks_to_microseconds(util::now_ticks()) / 1000;
+        }
+
+        int id(LONG index) const throw()
+        {
+            return int((entries_[index].generation << INDEX_BITS) | index);
+        }
+
+        LONG allocate()
+        {
+            if (NIL != free_)
+            {
+                LONG const index = free_;
+                free_ = entries_[index].next;
+                return index;
+            }
+            if (INDEX_MASK < entries_.size())
+                throw std::bad_alloc();
+            entries_.push_back(entry());
+            return LONG(entries_.size() - 1);
+        }
+
+        void release(LONG index) throw()
+        {
+            entry& e = entries_[index];
+            delete e.callback;
+            e.callback = NULL;
+            e.state = FREE;
+            e.generation = (e.generation + 1) & 0x3FF; // keeps ids positive
+            e.next = free_;
+            free_ = index;
+        }
+
+        LONG& slot(ULONGLONG due) throw()
+        {
+            ULONGLONG const delta = due - now_;
+            size_t level = 0;
+            while (level + 1 < LEVELS && (delta >> (LEVEL_BITS * (level + 1))))
+                ++level;
+            size_t const index = size_t(due >> (LEVEL_BITS * level)) & (SLOTS - 1);
+            return heads_[level * SLOTS + index];
+        }
+
+        void link(LONG index, ULONGLONG due) throw()
+        {
+            entry& e = entries_[index];
+            e.due = due;
+            LONG& head = slot(due);
+            e.prev = NIL;
+            e.next = head;
+            if (NIL != head)
+                entries_[head].prev = index;
+            head = index;
+            ++pending_;
+        }
+
+        void unlink(LONG index) throw()
+        {
+            entry& e = entries_[index];
+            if (NIL != e.prev)
+                entries_[e.prev].next = e.next;
+            else
+                slot_of(index) = e.next;
+            if (NIL != e.next)
+                entries_[e.next].prev = e.prev;
+            e.prev = e.next = NIL;
+            --pending_;
+        }
+
+        // the slot whose list starts with index
+        LONG& slot_of(LONG index) throw()
+        {
+            for (size_t level = 0; level < LEVELS; ++level)
+            {
+                size_t const i = size_t(entries_[index].due >> (LEVEL_BITS * level)) & (SLOTS - 1);
+                if (heads_[level * SLOTS + i] == index)
+                    return heads_[level * SLOTS + i];
+            }
+            APSL_ASSERT(0);
+            return heads_[0];
+        }
+
+        // when a level wraps, the next slot of the level above is spread
+        // over the levels below
+        void cascade() throw()
+        {
+            for (size_t level = 1; level < LEVELS; ++level)
+            {
+                if (now_ & ((ULONGLONG(1) << (LEVEL_BITS * level)) - 1))
+                    return;
+                size_t const i = size_t(now_ >> (LEVEL_BITS * level)) & (SLOTS - 1);
+                LONG index = heads_[level * SLOTS + i];
+                heads_[level * SLOTS + i] = NIL;
+                while (NIL != index)
+                {
+                    LONG const next = entries_[index].next;
+                    --pending_;
+                    link(index, entries_[index].due);
+                    index = next;
+                }
+            }
+        }
+
+        timer_wheel(timer_wheel const&);
+        timer_wheel& operator = (timer_wheel const&);
+
+        ULONGLONG now_;
+        LONG heads_[LEVELS * SLOTS];
+        std::vector<entry> entries_;
+        LONG free_;
+        size_t pending_;
+    };
+
+    //////////////////////////////////////////////////////////////////////
+    //
+    //  @class script_engine
+    //
+    static util::thread_local_pointer<script_engine> current_engine;
+
+    script_engine::scope::scope(script_engine& engine) throw()
+    : previous_(current_engine.get())
+    , previous_arena_(current_arena())
+    {
+        current_engine.set(&engine);
+        set_current_arena(engine.arena_);
+    }
+
+    script_engine::scope::~scope() throw()
+    {
+        set_current_arena(previous_arena_);
+        current_engine.set(previous_);
+    }
+
+    //////////////////////////////////////////////////////////////////////
+    //
+    //  timer built-ins; callbacks are function values, not source text
+    //
+    static int script_set_timeout(PSL::variable callback, int delay)
+    {
+        return script_engine::current()->set_timer(callback, ULONG(delay < 0 ? 0: delay));
+    }
+
+    static int script_set_interval(PSL::variable callback, int period)
+    {
+        ULONG const ms = ULONG(period < 1 ? 1: period);
+        return script_engine::current()->set_timer(callback, ms, ms);
+    }
+
+    static void script_clear_timer(int id)
+    {
+        script_engine::current()->clear_timer(id);
+    }
+
+    // enumerate(collection): the elements of a host collection as an array
+    static PSL::variable script_enumerate(PSL::variable collection)
+    {
+        PSL::variable items(PSL::variable::RARRAY);
+        if (PSL::variable::POINTER != collection.type()
+            || !enumerate_collection((LPDISPATCH)(void *)collection, items))
+            return PSL::variable(); // NIL
+        return items;
+    }
+
+    script_engine::script_engine()
+    : stats_(new engine_stats)
+    , profiler_(new aPSL::profiler)
+    , writes_(new write_queue)
+    , timers_(new timer_wheel)
+    , reads_(new read_cache)
+    , names_(new name_registry)
+    , read_caching_(false)
+    , arena_(new memory_arena)
+    , write_combining_(false)
+    {
+        scope guard(*this);
+        PSL::variable *stats = new stats_object(*stats_);
+        vm.add("aPSLStats", *stats);
+        def("setTimeout", &script_set_timeout);
+        def("setInterval", &script_set_interval);
+        def("clearTimeout", &script_clear_timer);
+        def("clearInterval", &script_clear_timer);
+        def("enumerate", &script_enumerate);
+    }
+
+    script_engine::~script_engine() throw()
+    {
+        try {
+            flush_writes();
+        }
+        catch (...) {
+            // no script left to report a refused put to
+        }
+        delete names_;
+        delete reads_;
+        delete timers_;
+        delete writes_;
+        delete profiler_;
+        stats_->release();
+        arena_->release();
+    }
+
+    void script_engine::eval(const char *text, DWORD cookie, ULONG line)
+    {
+        scope guard(*this);
+        check_quota();
+        profile_frame frame(profiler_, cookie, line, "<global>");
+        {
+            scoped_timer timer(*stats_, APSL_COUNTER_COMPILE_MICROSECONDS);
+            quota_scope enforce;
+            vm.LoadString(text);
+        }
+        scoped_timer timer(*stats_, APSL_COUNTER_RUN_MICROSECONDS);
+        try {
+            quota_scope enforce;
+            vm.Run();
+        }
+        catch (...) {
+            leave_script_after_error();
+            throw;
+        }
+        invalidate_reads();
+        flush_writes();
+    }
+
+    void script_engine::run(prepared_script const& script)
+    {
+        eval(script.text(), script.cookie(), script.line());
+    }
+
+    void script_engine::load(prepared_script const& script)
+    {
+        if (script.cookie())
+        {
+            std::map<DWORD, prepared_script>::iterator it = sources_.find(script.cookie());
+            if (sources_.end() == it)
+                sources_.insert(std::make_pair(script.cookie(), script));
+            else
+                it->second = script;
+        }
+        run(script);
+    }
+
+    bool script_engine::forget(DWORD cookie) throw()
+    {
+        return 0 != sources_.erase(cookie);
+    }
+
+    // PSLVM has no function table to patch, so the definitions that
+    // changed are loaded again, together, rebinding the globals they
+    // name.  The block is only remembered once they have loaded, so a
+    // failed reload is retried in full by the next one.
+    bool script_engine::reload(prepared_script const& script, size_t *reloaded)
+    {
+        if (reloaded)
+            *reloaded = 0;
+        std::map<DWORD, prepared_script>::iterator const it = sources_.find(script.cookie());
+        if (sources_.end() == it)
+        {
+            load(script);
+            return true;
+        }
+        source_diff diff;
+        diff_sources(it->second, script, diff);
+        if (diff.definitions)
+        {
+            eval(diff.text.c_str(), script.cookie(), diff.line);
+            stats_->add(APSL_COUNTER_FUNCTIONS_RELOADED, LONGLONG(diff.definitions));
+        }
+        if (reloaded)
+            *reloaded = diff.definitions;
+        it->second = script;
+        return diff.complete;
+    }
+
+    int script_engine::set_timer(PSL::variable const& callback, ULONG delay, ULONG period)
+    {
+        scope guard(*this);
+        return timers_->add(callback, delay, period);
+    }
+
+    bool script_engine::clear_timer(int id) throw()
+    {
+        return timers_->cancel(id);
+    }
+
+    size_t script_engine::run_due_timers()
+    {
+        scope guard(*this);
+        profile_frame frame(profiler_, 0, 0, "<timers>");
+        scoped_timer timer(*stats_, APSL_COUNTER_RUN_MICROSECONDS);
+        size_t run;
+        try {
+            run = timers_->run_due();
+        }
+        catch (...) {
+            leave_script_after_error();
+            throw;
+        }
+        stats_->add(APSL_COUNTER_TIMERS_RUN, run);
+        invalidate_reads();
+        flush_writes();
+        return run;
+    }
+
+    ULONG script_engine::next_timer_due() const throw()
+    {
+        return timers_->next_due();
+    }
+
+    void script_engine::put__(const PSL::string& pstrName, const PSL::variable& v)
+    {
+        vm.add(pstrName, v);
+    }
+
+    // PSL values are reference counted and go away on their own; what
+    // the engine itself holds on to is the queue of deferred writes and
+    // the cached reads, so only a call that releases either is counted.
+    void script_engine::collect_garbage()
+    {
+        scope guard(*this);
+        scoped_timer timer(*stats_, APSL_COUNTER_GC_MICROSECONDS);
+        if (!writes_->empty() || !reads_->empty())
+            stats_->add(APSL_COUNTER_GC_FLUSHES);
+        invalidate_reads();
+        flush_writes();
+    }
+
+    void script_engine::memory_usage(ULONGLONG& current, ULONGLONG& peak) const throw()
+    {
+        current = arena_->current();
+        peak = arena_->peak();
+    }
+
+    void script_engine::set_memory_quota(ULONGLONG quota) throw()
+    {
+        arena_->set_quota(quota);
+    }
+
+    ULONGLONG script_engine::memory_quota() const throw()
+    {
+        return arena_->quota();
+    }
+
+    // A safe point may call the host, so the whole collection runs before
+    // giving up; the script is then aborted like on a host error, which
+    // every caller of this is prepared for.
+    void script_engine::check_quota()
+    {
+        if (!arena_->over_quota())
+            return;
+        collect_garbage();
+        if (arena_->over_quota())
+            throw quota_exceeded();
+    }
+
+    // Inside an allocation the VM may be half way through changing a
+    // value, so nothing that calls the host can run: deferred writes wait
+    // for the next safe point and only the cached reads are given back.
+    void refuse_over_quota(memory_arena& arena, size_t n)
+    {
+        if (script_engine *engine = script_engine::current())
+            engine->invalidate_reads();
+        if (!arena.over_quota())
+            return;
+        arena.discharge(n);
+        throw quota_exceeded();
+    }
+
+    void script_engine::set_member_flags(PSL::string const& name, DWORD flags)
+    {
+        if (APSL_MEMBER_DEFAULT == flags)
+            member_flags_.erase(name.c_str());
+        else
+            member_flags_[name.c_str()] = flags;
+        if (flags & APSL_MEMBER_IDEMPOTENT_GET)
+            read_caching_ = true;
+    }
+
+    bool script_engine::read_caching() const throw()
+    {
+        return read_caching_;
+    }
+
+    VARIANT const *script_engine::cached_read(IDispatch *pdisp, DISPID dispid) const throw()
+    {
+        return reads_->find(pdisp, dispid);
+    }
+
+    void script_engine::cache_read(IDispatch *pdisp, DISPID dispid, VARIANT const& value)
+    {
+        reads_->insert(pdisp, dispid, value);
+    }
+
+    void script_engine::invalidate_reads(IDispatch *pdisp) throw()
+    {
+        reads_->clear(pdisp);
+    }
+
+    DWORD script_engine::member_flags(char const *name) const
+    {
+        std::map<std::string, DWORD>::const_iterator it = member_flags_.find(name);
+        return it == member_flags_.end() ? DWORD(APSL_MEMBER_DEFAULT): it->second;
+    }
+
+    void script_engine::enable_write_combining(bool enable)
+    {
+        write_combining_ = enable;
+        if (!enable)
+            flush_writes();
+    }
+
+    bool script_engine::write_combining() const throw()
+    {
+        return write_combining_;
+    }
+
+    void script_engine::defer_put(IDispatch *pdisp, DISPID dispid, char const *name,
+                                  VARIANT& value)
+    {
+        writes_->push(pdisp, dispid, name, value, *stats_);
+    }
+
+    void script_engine::flush_writes(IDispatch *pdisp)
+    {
+        if (writes_->empty())
+            return;
+        scope guard(*this);
+        writes_->flush(pdisp, *stats_);
+    }
+
+    host_names *script_engine::names_of(IDispatch *pdisp)
+    {
+        return names_->find(pdisp);
+    }
+
+    void script_engine::invalidate_names() throw()
+    {
+        names_->invalidate();
+    }
+
+    LONG script_engine::names_generation() const throw()
+    {
+        return names_->generation();
+    }
+
+    // the script's own error wins over a put the host refused
+    void script_engine::leave_script_after_error() throw()
+    {
+        invalidate_reads();
+        try {
+            flush_writes();
+        }
+        catch (...) {
+        }
+    }
+
+    engine_stats& script_engine::stats() const throw()
+    {
+        return *stats_;
+    }
+
+    aPSL::profiler& script_engine::profiler() const throw()
+    {
+        return *profiler_;
+    }
+
+    script_engine *script_engine::current() throw()
+    {
+        return current_engine.get();
+    }
+
+    //////////////////////////////////////////////////////////////////////
+    //
+    //  @class batch_value
+    //
+    batch_value::batch_value() throw()
+    {
+        VariantInit(&v_);
+    }
+
+    batch_value::batch_value(int x) throw()
+    {
+        VariantInit(&v_);
+        v_.vt = VT_I4;
+        v_.lVal = x;
+    }
+
+    batch_value::batch_value(double x) throw()
+    {
+        VariantInit(&v_);
+        v_.vt = VT_R8;
+        v_.dblVal = x;
+    }
+
+    batch_value::batch_value(bool x) throw()
+    {
+        VariantInit(&v_);
+        v_.vt = VT_BOOL;
+        v_.boolVal = x ? VARIANT_TRUE: VARIANT_FALSE;
+    }
+
+    batch_value::batch_value(wchar_t const *x)
+    {
+        VariantInit(&v_);
+        v_.bstrVal = SysAllocString(x ? x: L"");
+        if (!v_.bstrVal)
+            throw std::bad_alloc();
+        v_.vt = VT_BSTR;
+    }
+
+    batch_value::batch_value(VARIANT const& v)
+    {
+        VariantInit(&v_);
+        VARTYPE const vt = v.vt & VT_TYPEMASK;
+        if ((v.vt & (VT_ARRAY | VT_BYREF)) || VT_DISPATCH == vt
+            || VT_UNKNOWN == vt || VT_VARIANT == vt || VT_RECORD == vt)
+            throw std::invalid_argument("batch_value: not plain data");
+        if (FAILED(VariantCopy(&v_, &v)))
+            throw std::bad_alloc();
+    }
+
+    batch_value::batch_value(batch_value const& other)
+    {
+        VariantInit(&v_);
+        if (FAILED(VariantCopy(&v_, &other.v_)))
+            throw std::bad_alloc();
+    }
+
+    batch_value& batch_value::operator = (batch_value const& other)
+    {
+        if (this != &other && FAILED(VariantCopy(&v_, &other.v_)))
+            throw std::bad_alloc();
+        return *this;
+    }
+
+    batch_value::~batch_value() throw()
+    {
+        VariantClear(&v_);
+    }
+
+    VARIANT const& batch_value::get() const throw()
+    {
+        return v_;
+    }
+
+    //////////////////////////////////////////////////////////////////////
+    //
+    //  @struct engine_pool::worker
+    //
+    struct engine_pool::worker
+    {
+        worker(engine_pool *pool, size_t index)
+        : pool(pool)
+        , index(index)
+        , thread(NULL)
+        , start_semaphore(CreateSemaphore(NULL, 0, LONG_MAX, NULL))
+        {
+        }
+
+        ~worker() throw()
+        {
+            CloseHandle(start_semaphore);
+            if (thread)
+                CloseHandle(thread);
+        }
+
+        engine_pool *pool;
+        size_t index;
+        HANDLE thread;
+        HANDLE start_semaphore;
+        util::critical_section critical_section;
+        std::deque<size_t> queue;
+    };
+
+    engine_pool::engine_pool(size_t workers, initializer init)
+    : init_(init)
+    , done_event_(CreateEvent(NULL, FALSE, FALSE, NULL))
+    , active_(0)
+    , stopping_(false)
+    , jobs_(NULL)
+    , results_(NULL)
+    {
+        if (0 == workers)
+        {
+            SYSTEM_INFO info;
+            GetSystemInfo(&info);
+            workers = info.dwNumberOfProcessors;
+        }
+        for (size_t i = 0; i < workers; ++i)
+        {
+            worker *w = new worker(this, i);
+            workers_.push_back(w);
+            w->thread = CreateThread(NULL, 0, &engine_pool::worker_main, w, 0, NULL);
+            if (NULL == w->thread)
+                throw std::runtime_error("engine_pool: CreateThread failed");
+        }
+    }
+
+    engine_pool::~engine_pool() throw()
+    {
+        stopping_ = true;
+        for (size_t i = 0; i < workers_.size(); ++i)
+            if (workers_[i]->thread)
+                ReleaseSemaphore(workers_[i]->start_semaphore, 1, NULL);
+        for (size_t i = 0; i < workers_.size(); ++i)
+        {
+            if (workers_[i]->thread)
+                WaitForSingleObject(workers_[i]->thread, INFINITE);
+            delete workers_[i];
+        }
+        CloseHandle(done_event_);
+    }
+
+    size_t engine_pool::size() const throw()
+    {
+        return workers_.size();
+    }
+
+    void engine_pool::run(std::vector<batch_job> const& jobs, std::vector<batch_result>& results)
+    {
+        results.assign(jobs.size(), batch_result());
+        if (jobs.empty())
+            return;
+        jobs_ = &jobs;
+        results_ = &results;
+        size_t const n = workers_.size();
+        for (size_t i = 0; i < n; ++i)
+        {
+            worker& w = *workers_[i];
+            util::scoped_lock lock(w.critical_section);
+            for (size_t j = jobs.size() * i / n; j < jobs.size() * (i + 1) / n; ++j)
+                w.queue.push_back(j);
+        }
+        active_ = LONG(n);
+        for (size_t i = 0; i < n; ++i)
+            ReleaseSemaphore(workers_[i]->start_semaphore, 1, NULL);
+        WaitForSingleObject(done_event_, INFINITE);
+        jobs_ = NULL;
+        results_ = NULL;
+    }
+
+    // own queue from the front, then the back of everybody else's
+    bool engine_pool::next_job(worker& self, size_t& index) throw()
+    {
+        {
+            util::scoped_lock lock(self.critical_section);
+            if (!self.queue.empty())
+            {
+                index = self.queue.front();
+                self.queue.pop_front();
+                return true;
+            }
+        }
+        size_t const n = workers_.size();
+        for (size_t i = 1; i < n; ++i)
+        {
+            worker& victim = *workers_[(self.index + i) % n];
+            util::scoped_lock lock(victim.critical_section);
+            if (!victim.queue.empty())
+            {
+                index = victim.queue.back();
+                victim.queue.pop_back();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // PSLVM cannot forget a global, so a job never inherits an engine:
+    // it gets a fresh one, and "result" is bound to a variable of this
+    // frame that outlives it.  Values are rebuilt from, and copied back
+    // into, plain VARIANTs on this thread.
+    void engine_pool::execute(size_t index) throw()
+    {
+        batch_job const& job = (*jobs_)[index];
+        batch_result& result = (*results_)[index];
+        try {
+            PSL::variable value;
+            script_engine engine;
+            script_engine::scope guard(engine);
+            if (init_)
+                init_(engine);
+            for (size_t i = 0; i < job.bindings.size(); ++i)
+            {
+                PSL::variable *binding = variant_to_variable(job.bindings[i].second.get());
+                engine.put__(job.bindings[i].first.c_str(), *binding);
+                delete binding;
+            }
+            engine.bind("result", &value);
+            engine.run(job.script);
+            util::scoped_variant const plain = variable_to_variant(value);
+            result.value = batch_value(plain.get());
+            result.hr = S_OK;
+        }
+        catch (host_error const& e) {
+            result.hr = e.hr();
+        }
+        catch (std::invalid_argument const&) {
+            result.hr = DISP_E_TYPEMISMATCH;
+        }
+        catch (...) {
+            result.hr = E_FAIL;
+        }
+    }
+
+    DWORD WINAPI engine_pool::worker_main(LPVOID param) throw()
+    {
+        worker& self = *static_cast<worker *>(param);
+        engine_pool& pool = *self.pool;
+        for (;;)
+        {
+            WaitForSingleObject(self.start_semaphore, INFINITE);
+            if (pool.stopping_)
+                break;
+            size_t index;
+            while (pool.next_job(self, index))
+                pool.execute(index);
+            if (0 == InterlockedDecrement(&pool.active_))
+                SetEvent(pool.done_event_);
+        }
+        return 0;
+    }
+
+    // Counts whatever happens with no engine current on the thread, from
+    // any number of threads at once.  Made during static initialization,
+    // before a host can start threads, rather than on first use, which
+    // two threads could race; never freed, as wrappers may outlive it.
+    static engine_stats *const orphan_stats = new engine_stats;
+
+    engine_stats& current_stats() throw()
+    {
+        script_engine *engine = script_engine::current();
+        return engine ? engine->stats(): *orphan_stats;
+    }
+
+    profiler *current_profiler() throw()
+    {
+        script_engine *engine = script_engine::current();
+        if (!engine || !engine->profiler().enabled())
+            return NULL;
+        return &engine->profiler();
+    }
 
-    private:
-        PSL::PSLVM vm;
-    };
+    wrapper_counter::wrapper_counter() throw()
+    : stats_(&current_stats())
+    {
+        stats_->add_ref();
+        stats_->add(APSL_COUNTER_WRAPPERS_ALIVE);
+    }
 
 
     //////////////////////////////////////////////////////////////////////////////
@@ -589,7 +4449,7 @@ namespace aPSL {
         }
     
     private:
-        long count_;
+        LONG volatile count_;
     
     };
 
@@ -655,15 +4515,17 @@ class __declspec(novtable) IActiveScriptImpl
 {
     public:
         IActiveScriptImpl() throw()
-        : m_p_script_engine(NULL)
-        , m_p_scriptsite_object(NULL)
+        : m_p_scriptsite_object(NULL)
+        , m_script_state(SCRIPTSTATE_UNINITIALIZED)
+        , m_ActiveScriptSite(NULL)
+        , m_p_script_engine(NULL)
         {
         }
 
         ~IActiveScriptImpl() throw()
         {
-            if (m_p_scriptsite_object)
-                delete m_p_scriptsite_object;
+            delete m_p_script_engine;
+            delete m_p_scriptsite_object;
         }
 
         STDMETHOD(SetScriptSite)(IActiveScriptSite *pass)
@@ -674,9 +4536,9 @@ class __declspec(novtable) IActiveScriptImpl
             if (NULL == m_p_scriptsite_object)
                 return E_OUTOFMEMORY;
             m_script_state = SCRIPTSTATE_INITIALIZED;
-            PSL::variable *window = m_p_scriptsite_object->get__(L"window");
-            
             m_p_script_engine = new aPSL::script_engine();
+            aPSL::script_engine::scope guard(*m_p_script_engine);
+            PSL::variable *window = m_p_scriptsite_object->get__(L"window");
             m_p_script_engine->put__("window", *window);
             return S_OK;
         }
@@ -684,6 +4546,8 @@ class __declspec(novtable) IActiveScriptImpl
         STDMETHOD(GetScriptSite)(REFIID riid, LPVOID *ppvObject)
         {
             APSL_TRACE ("IActiveScript::GetScriptSite");
+            if (!m_ActiveScriptSite)
+                return E_UNEXPECTED;
             return m_ActiveScriptSite->QueryInterface(riid, ppvObject);
         }
 
@@ -704,9 +4568,17 @@ class __declspec(novtable) IActiveScriptImpl
             return *pssState = m_script_state, S_OK;
         }
 
+        // drops every script value, and with them the host objects they
+        // hold, then the site
         STDMETHOD(Close)(VOID)
         {
             APSL_TRACE ("IActiveScript::Close");
+            delete m_p_script_engine;
+            m_p_script_engine = NULL;
+            delete m_p_scriptsite_object;
+            m_p_scriptsite_object = NULL;
+            m_ActiveScriptSite = NULL;
+            m_script_state = SCRIPTSTATE_CLOSED;
             return S_OK;
         };
 
@@ -718,8 +4590,9 @@ class __declspec(novtable) IActiveScriptImpl
             if (!m_p_scriptsite_object)
                 return E_POINTER;
             
+            aPSL::script_engine::scope guard(*m_p_script_engine);
             PSL::variable *scriptsite = m_p_scriptsite_object->get__(pstrName);
-            m_p_script_engine->put__(pstrName, scriptsite);
+            m_p_script_engine->put__(aPSL::util::narrow(pstrName).c_str(), scriptsite);
             return S_OK;
         }
 
@@ -810,17 +4683,27 @@ public:
         if (0 == pstrItemName || 0 == pstrEventName)
             return E_INVALIDARG;
 
-        _bstr_t code = pstrItemName;
         if (pstrSubItemName) {
             return E_UNEXPECTED;
         }
         // TODO:
         //    code = code + L"." + pstrSubItemName;
         //code = code + L"." + pstrEventName + L"=function(){" + pstrCode + L"}";
-        
-        pthis->m_p_script_engine->eval(_bstr_t(code));
-                
-        return S_OK;
+
+        if (!pthis->m_p_script_engine)
+            return E_UNEXPECTED;
+        // scriptlets are not source blocks; nothing is kept for reload
+        try {
+            aPSL::script_engine::scope guard(*pthis->m_p_script_engine);
+            aPSL::prepared_script const script(
+                pstrItemName, dwSourceContextCookie, ulStartingLineNumber);
+            pthis->m_p_script_engine->eval(
+                script.text(), script.cookie(), script.line());
+        }
+        catch (...) {
+            hr = aPSL::report_exception(pexcepinfo);
+        }
+        return hr;
     }
 
     STDMETHOD(ParseScriptText)(
@@ -836,13 +4719,23 @@ public:
     {
         HRESULT hr = S_OK;
         T* pthis = static_cast<T*>(this);
+        if (!pthis->m_p_script_engine || !pthis->m_ActiveScriptSite)
+            return E_UNEXPECTED;
         pthis->m_ActiveScriptSite->OnStateChange(
             pthis->m_script_state = SCRIPTSTATE_STARTED);
-        pthis->m_p_script_engine->eval(_bstr_t(pstrCode));
+        try {
+            aPSL::script_engine::scope guard(*pthis->m_p_script_engine);
+            aPSL::prepared_script const script(
+                pstrCode, dwSourceContextCookie, ulStartingLineNumber);
+            pthis->m_p_script_engine->load(script);
+        }
+        catch (...) {
+            hr = aPSL::report_exception(pexcepinfo);
+        }
         pthis->m_ActiveScriptSite->OnLeaveScript();
         pthis->m_script_state = SCRIPTSTATE_INITIALIZED;
 	    pthis->m_ActiveScriptSite->OnStateChange(pthis->m_script_state);
-        return S_OK;
+        return hr;
     }
 
     STDMETHOD(InitNew)(VOID)
@@ -870,11 +4763,390 @@ class __declspec(novtable) IActiveScriptGarbageCollectorImpl
         HRESULT STDMETHODCALLTYPE CollectGarbage(
             SCRIPTGCTYPE scriptgctype)
         {
-            ::MessageBoxW(0,L"CollectGarbage",0,0);
+            T *const pthis = static_cast<T*>(this);
+            if (!pthis->m_p_script_engine)
+                return E_UNEXPECTED;
+            try {
+                pthis->m_p_script_engine->collect_garbage();
+            }
+            catch (aPSL::host_error const& e) {
+                return e.hr(); // a queued put the host refused
+            }
+            catch (...) {
+                return E_UNEXPECTED;
+            }
             return S_OK;
         };
 };
 
+////////////////////////////////////////////////////////////////////////////
+//
+// @class IaPSLScriptStatsImpl
+//
+template <class T>
+class __declspec(novtable) IaPSLScriptStatsImpl
+: public IaPSLScriptStats
+{
+public:
+    STDMETHOD(GetCounter)(APSL_COUNTER counter, ULONGLONG *pullValue)
+    {
+        T *const pthis = static_cast<T*>(this);
+        if (!pullValue)
+            return E_POINTER;
+        if (counter < 0 || APSL_COUNTER_MAX <= counter)
+            return E_INVALIDARG;
+        if (!pthis->m_p_script_engine)
+            return E_UNEXPECTED;
+        *pullValue = pthis->m_p_script_engine->stats().get(counter);
+        return S_OK;
+    }
+
+    STDMETHOD(GetConversionCount)(
+        VARTYPE vt, ULONGLONG *pullToVariant, ULONGLONG *pullFromVariant)
+    {
+        T *const pthis = static_cast<T*>(this);
+        if (!pullToVariant || !pullFromVariant)
+            return E_POINTER;
+        if (!pthis->m_p_script_engine)
+            return E_UNEXPECTED;
+        aPSL::engine_stats const& stats = pthis->m_p_script_engine->stats();
+        *pullToVariant = stats.to_variant(vt);
+        *pullFromVariant = stats.from_variant(vt);
+        return S_OK;
+    }
+
+    STDMETHOD(ResetCounters)(VOID)
+    {
+        T *const pthis = static_cast<T*>(this);
+        if (!pthis->m_p_script_engine)
+            return E_UNEXPECTED;
+        pthis->m_p_script_engine->stats().reset();
+        return S_OK;
+    }
+};
+
+////////////////////////////////////////////////////////////////////////////
+//
+// @class IaPSLScriptProfilerImpl
+//
+template <class T>
+class __declspec(novtable) IaPSLScriptProfilerImpl
+: public IaPSLScriptProfiler
+{
+public:
+    STDMETHOD(StartProfiling)(ULONG ulIntervalMilliseconds)
+    {
+        T *const pthis = static_cast<T*>(this);
+        if (!pthis->m_p_script_engine)
+            return E_UNEXPECTED;
+        return pthis->m_p_script_engine->profiler().start(ulIntervalMilliseconds);
+    }
+
+    STDMETHOD(StopProfiling)(VOID)
+    {
+        T *const pthis = static_cast<T*>(this);
+        if (!pthis->m_p_script_engine)
+            return E_UNEXPECTED;
+        pthis->m_p_script_engine->profiler().stop();
+        return S_OK;
+    }
+
+    STDMETHOD(GetProfile)(APSL_PROFILE_VIEW view, BSTR *pbstrProfile)
+    {
+        T *const pthis = static_cast<T*>(this);
+        if (!pbstrProfile)
+            return E_POINTER;
+        if (view < APSL_PROFILE_FOLDED || APSL_PROFILE_FUNCTIONS < view)
+            return E_INVALIDARG;
+        if (!pthis->m_p_script_engine)
+            return E_UNEXPECTED;
+        try {
+            std::string const profile
+                = pthis->m_p_script_engine->profiler().report(view);
+            *pbstrProfile = aPSL::util::to_bstr(profile.c_str(), profile.length());
+        }
+        catch (...) {
+            return E_OUTOFMEMORY;
+        }
+        return S_OK;
+    }
+
+    STDMETHOD(ClearProfile)(VOID)
+    {
+        T *const pthis = static_cast<T*>(this);
+        if (!pthis->m_p_script_engine)
+            return E_UNEXPECTED;
+        pthis->m_p_script_engine->profiler().clear();
+        return S_OK;
+    }
+};
+
+////////////////////////////////////////////////////////////////////////////
+//
+// @class IaPSLScriptHostNamesImpl
+//
+template <class T>
+class __declspec(novtable) IaPSLScriptHostNamesImpl
+: public IaPSLScriptHostNames
+{
+public:
+    STDMETHOD(InvalidateMemberNames)(VOID)
+    {
+        T *const pthis = static_cast<T*>(this);
+        if (!pthis->m_p_script_engine)
+            return E_UNEXPECTED;
+        pthis->m_p_script_engine->invalidate_names();
+        return S_OK;
+    }
+};
+
+////////////////////////////////////////////////////////////////////////////
+//
+// @class IaPSLScriptMemberHintsImpl
+//
+template <class T>
+class __declspec(novtable) IaPSLScriptMemberHintsImpl
+: public IaPSLScriptMemberHints
+{
+public:
+    STDMETHOD(SetMemberFlags)(LPCOLESTR pstrName, DWORD dwFlags)
+    {
+        T *const pthis = static_cast<T*>(this);
+        if (!pstrName)
+            return E_POINTER;
+        if (!pthis->m_p_script_engine)
+            return E_UNEXPECTED;
+        try {
+            pthis->m_p_script_engine->set_member_flags(
+                aPSL::util::narrow(pstrName).c_str(), dwFlags);
+        }
+        catch (...) {
+            return E_OUTOFMEMORY;
+        }
+        return S_OK;
+    }
+
+    STDMETHOD(GetMemberFlags)(LPCOLESTR pstrName, DWORD *pdwFlags)
+    {
+        T *const pthis = static_cast<T*>(this);
+        if (!pstrName || !pdwFlags)
+            return E_POINTER;
+        if (!pthis->m_p_script_engine)
+            return E_UNEXPECTED;
+        try {
+            *pdwFlags = pthis->m_p_script_engine->member_flags(
+                aPSL::util::narrow(pstrName).c_str());
+        }
+        catch (...) {
+            return E_OUTOFMEMORY;
+        }
+        return S_OK;
+    }
+
+    STDMETHOD(EnableWriteCombining)(BOOL fEnable)
+    {
+        T *const pthis = static_cast<T*>(this);
+        if (!pthis->m_p_script_engine)
+            return E_UNEXPECTED;
+        try {
+            pthis->m_p_script_engine->enable_write_combining(FALSE != fEnable);
+        }
+        catch (aPSL::host_error const& e) {
+            return e.hr(); // a queued put the host refused
+        }
+        catch (...) {
+            return E_UNEXPECTED;
+        }
+        return S_OK;
+    }
+};
+
+////////////////////////////////////////////////////////////////////////////
+//
+// @class IaPSLScriptMemoryImpl
+//
+template <class T>
+class __declspec(novtable) IaPSLScriptMemoryImpl
+: public IaPSLScriptMemory
+{
+public:
+    STDMETHOD(GetMemoryUsage)(ULONGLONG *pullCurrentBytes, ULONGLONG *pullPeakBytes)
+    {
+        T *const pthis = static_cast<T*>(this);
+        if (!pullCurrentBytes || !pullPeakBytes)
+            return E_POINTER;
+        if (!pthis->m_p_script_engine)
+            return E_UNEXPECTED;
+        pthis->m_p_script_engine->memory_usage(*pullCurrentBytes, *pullPeakBytes);
+        return S_OK;
+    }
+
+    STDMETHOD(SetMemoryQuota)(ULONGLONG ullBytes)
+    {
+        T *const pthis = static_cast<T*>(this);
+        if (!pthis->m_p_script_engine)
+            return E_UNEXPECTED;
+        pthis->m_p_script_engine->set_memory_quota(ullBytes);
+        return S_OK;
+    }
+
+    STDMETHOD(GetMemoryQuota)(ULONGLONG *pullBytes)
+    {
+        T *const pthis = static_cast<T*>(this);
+        if (!pullBytes)
+            return E_POINTER;
+        if (!pthis->m_p_script_engine)
+            return E_UNEXPECTED;
+        *pullBytes = pthis->m_p_script_engine->memory_quota();
+        return S_OK;
+    }
+};
+
+////////////////////////////////////////////////////////////////////////////
+//
+// @class IaPSLScriptSchedulerImpl
+//
+template <class T>
+class __declspec(novtable) IaPSLScriptSchedulerImpl
+: public IaPSLScriptScheduler
+{
+public:
+    STDMETHOD(RunDueTasks)(ULONG *pcTasksRun, EXCEPINFO *pexcepinfo)
+    {
+        T *const pthis = static_cast<T*>(this);
+        if (pcTasksRun)
+            *pcTasksRun = 0;
+        if (!pthis->m_p_script_engine || !pthis->m_ActiveScriptSite)
+            return E_UNEXPECTED;
+        HRESULT hr = S_OK;
+        pthis->m_ActiveScriptSite->OnStateChange(
+            pthis->m_script_state = SCRIPTSTATE_STARTED);
+        try {
+            size_t const run = pthis->m_p_script_engine->run_due_timers();
+            if (pcTasksRun)
+                *pcTasksRun = ULONG(run);
+        }
+        catch (...) {
+            hr = aPSL::report_exception(pexcepinfo);
+        }
+        pthis->m_ActiveScriptSite->OnLeaveScript();
+        pthis->m_script_state = SCRIPTSTATE_INITIALIZED;
+        pthis->m_ActiveScriptSite->OnStateChange(pthis->m_script_state);
+        return hr;
+    }
+
+    STDMETHOD(GetNextDueTime)(ULONG *pulMilliseconds)
+    {
+        T *const pthis = static_cast<T*>(this);
+        if (!pulMilliseconds)
+            return E_POINTER;
+        if (!pthis->m_p_script_engine)
+            return E_UNEXPECTED;
+        *pulMilliseconds = pthis->m_p_script_engine->next_timer_due();
+        return S_OK;
+    }
+};
+
+////////////////////////////////////////////////////////////////////////////
+//
+// @class IaPSLScriptParseBatchImpl
+//
+template <class T>
+class __declspec(novtable) IaPSLScriptParseBatchImpl
+: public IaPSLScriptParseBatch
+{
+public:
+    STDMETHOD(ParseScriptTextBatch)(
+        ULONG cBlocks,
+        LPCOLESTR const *rgpstrCode,
+        DWORD const *rgdwSourceContextCookie,
+        ULONG const *rgulStartingLineNumber,
+        HRESULT *rghrResults,
+        EXCEPINFO *rgExcepinfo)
+    {
+        T *const pthis = static_cast<T*>(this);
+        if (!rgpstrCode || !rghrResults)
+            return E_POINTER;
+        if (!pthis->m_p_script_engine || !pthis->m_ActiveScriptSite)
+            return E_UNEXPECTED;
+        HRESULT hr = S_OK;
+        pthis->m_ActiveScriptSite->OnStateChange(
+            pthis->m_script_state = SCRIPTSTATE_STARTED);
+        for (ULONG i = 0; i < cBlocks; ++i)
+        {
+            rghrResults[i] = S_OK;
+            try {
+                aPSL::script_engine::scope guard(*pthis->m_p_script_engine);
+                aPSL::prepared_script const script(
+                    rgpstrCode[i],
+                    rgdwSourceContextCookie ? rgdwSourceContextCookie[i]: 0,
+                    rgulStartingLineNumber ? rgulStartingLineNumber[i]: 0);
+                pthis->m_p_script_engine->load(script);
+            }
+            catch (...) {
+                rghrResults[i] = aPSL::report_exception(
+                    rgExcepinfo ? &rgExcepinfo[i]: NULL);
+                hr = S_FALSE;
+            }
+        }
+        pthis->m_ActiveScriptSite->OnLeaveScript();
+        pthis->m_script_state = SCRIPTSTATE_INITIALIZED;
+        pthis->m_ActiveScriptSite->OnStateChange(pthis->m_script_state);
+        return hr;
+    }
+};
+
+////////////////////////////////////////////////////////////////////////////
+//
+// @class IaPSLScriptReloadImpl
+//
+template <class T>
+class __declspec(novtable) IaPSLScriptReloadImpl
+: public IaPSLScriptReload
+{
+public:
+    STDMETHOD(ReloadScriptText)(
+        LPCOLESTR pstrCode,
+        DWORD dwSourceContextCookie,
+        ULONG ulStartingLineNumber,
+        ULONG *pcFunctionsReloaded,
+        EXCEPINFO *pexcepinfo)
+    {
+        T *const pthis = static_cast<T*>(this);
+        if (pcFunctionsReloaded)
+            *pcFunctionsReloaded = 0;
+        if (!pthis->m_p_script_engine || !pthis->m_ActiveScriptSite)
+            return E_UNEXPECTED;
+        HRESULT hr = S_OK;
+        pthis->m_ActiveScriptSite->OnStateChange(
+            pthis->m_script_state = SCRIPTSTATE_STARTED);
+        try {
+            aPSL::script_engine::scope guard(*pthis->m_p_script_engine);
+            aPSL::prepared_script script(pstrCode, dwSourceContextCookie, ulStartingLineNumber);
+            size_t reloaded = 0;
+            if (!pthis->m_p_script_engine->reload(script, &reloaded))
+                hr = S_FALSE;
+            if (pcFunctionsReloaded)
+                *pcFunctionsReloaded = ULONG(reloaded);
+        }
+        catch (...) {
+            hr = aPSL::report_exception(pexcepinfo);
+        }
+        pthis->m_ActiveScriptSite->OnLeaveScript();
+        pthis->m_script_state = SCRIPTSTATE_INITIALIZED;
+        pthis->m_ActiveScriptSite->OnStateChange(pthis->m_script_state);
+        return hr;
+    }
+
+    STDMETHOD(ForgetScriptText)(DWORD dwSourceContextCookie)
+    {
+        T *const pthis = static_cast<T*>(this);
+        if (!pthis->m_p_script_engine)
+            return E_UNEXPECTED;
+        return pthis->m_p_script_engine->forget(dwSourceContextCookie) ? S_OK: S_FALSE;
+    }
+};
+
 ///////////////////////////////////////////////////////////////////////////
 //
 // @class CScriptObject
@@ -884,21 +5156,45 @@ CScriptObject
     : public IActiveScriptImpl<CScriptObject>
     , public IActiveScriptParseImpl<CScriptObject>
     , public IActiveScriptGarbageCollectorImpl<CScriptObject>
+    , public IaPSLScriptStatsImpl<CScriptObject>
+    , public IaPSLScriptProfilerImpl<CScriptObject>
+    , public IaPSLScriptHostNamesImpl<CScriptObject>
+    , public IaPSLScriptMemberHintsImpl<CScriptObject>
+    , public IaPSLScriptMemoryImpl<CScriptObject>
+    , public IaPSLScriptSchedulerImpl<CScriptObject>
+    , public IaPSLScriptParseBatchImpl<CScriptObject>
+    , public IaPSLScriptReloadImpl<CScriptObject>
 {
 public:
+    // per instance: the entries hold this object's interface pointers
     INTERFACE_ENTRY const * GetInterfaceMap()
     {
-        static INTERFACE_ENTRY interface_map[] = {
+        INTERFACE_ENTRY const interface_map[] = {
             { &__uuidof(IUnknown) , static_cast<IActiveScript *>(this) },
             { &__uuidof(IActiveScript) , static_cast<IActiveScript *>(this) },
             { &__uuidof(IActiveScriptParse) , static_cast<IActiveScriptParse *>(this) },
             { &__uuidof(IActiveScriptGarbageCollector) , static_cast<IActiveScriptGarbageCollector *>(this) },
+            { &__uuidof(IaPSLScriptStats) , static_cast<IaPSLScriptStats *>(this) },
+            { &__uuidof(IaPSLScriptProfiler) , static_cast<IaPSLScriptProfiler *>(this) },
+            { &__uuidof(IaPSLScriptHostNames) , static_cast<IaPSLScriptHostNames *>(this) },
+            { &__uuidof(IaPSLScriptMemberHints) , static_cast<IaPSLScriptMemberHints *>(this) },
+            { &__uuidof(IaPSLScriptMemory) , static_cast<IaPSLScriptMemory *>(this) },
+            { &__uuidof(IaPSLScriptScheduler) , static_cast<IaPSLScriptScheduler *>(this) },
+            { &__uuidof(IaPSLScriptParseBatch) , static_cast<IaPSLScriptParseBatch *>(this) },
+            { &__uuidof(IaPSLScriptReload) , static_cast<IaPSLScriptReload *>(this) },
             { NULL, NULL }
         };
-        return interface_map;
+        std::copy(interface_map, interface_map + INTERFACE_COUNT, m_interface_map);
+        return m_interface_map;
     }
+
+private:
+    enum { INTERFACE_COUNT = 13 };
+    INTERFACE_ENTRY m_interface_map[INTERFACE_COUNT];
 };
 
+#ifndef APSL_STATIC
+
 ///////////////////////////////////////////////////////////////////////////
 //
 // @class CComFactory
@@ -1096,4 +5392,4 @@ STDAPI DllRegisterServer(VOID)
     return S_OK;
 }
 
-
+#endif // APSL_STATIC
@@ -0,0 +1,922 @@
+
+#ifndef APSL_H
+#define APSL_H
+
+#include <ActivScp.h>
+#include <exception>
+#include <map>
+#include <new>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "PSL/PSL.h"
+
+//////////////////////////////////////////////////////////////////////////
+//
+//  @enum APSL_COUNTER
+//  @brief runtime counters maintained by each script engine
+//
+enum APSL_COUNTER
+{
+    APSL_COUNTER_HOST_CALLS = 0,
+    APSL_COUNTER_HOST_PROPERTY_GETS,
+    APSL_COUNTER_HOST_PROPERTY_PUTS,
+    APSL_COUNTER_DISPID_LOOKUPS,
+    APSL_COUNTER_DISPID_CACHE_HITS,
+    APSL_COUNTER_DISPID_CACHE_MISSES,
+    APSL_COUNTER_BYTES_TRANSCODED,
+    APSL_COUNTER_WRAPPERS_ALIVE,
+    APSL_COUNTER_COMPILE_MICROSECONDS,
+    APSL_COUNTER_RUN_MICROSECONDS,
+    APSL_COUNTER_GC_FLUSHES,
+    APSL_COUNTER_GC_MICROSECONDS,
+    APSL_COUNTER_NEGATIVE_CACHE_HITS,
+    APSL_COUNTER_DEFERRED_PUTS,
+    APSL_COUNTER_COALESCED_PUTS,
+    APSL_COUNTER_TIMERS_RUN,
+    APSL_COUNTER_ENUM_ITEMS,
+    APSL_COUNTER_READ_CACHE_HITS,
+    APSL_COUNTER_FUNCTIONS_RELOADED,
+    APSL_COUNTER_MAX
+};
+
+//////////////////////////////////////////////////////////////////////////
+//
+//  @interface IaPSLScriptStats
+//  @brief read access to the engine counters for the host
+//
+MIDL_INTERFACE("9194FC4A-6D94-40C1-A585-A1267D23F815")
+IaPSLScriptStats : public IUnknown
+{
+public:
+    STDMETHOD(GetCounter)(
+        APSL_COUNTER counter,
+        ULONGLONG *pullValue) = 0;
+
+    // number of conversions from/to VARIANT of the given VARTYPE
+    STDMETHOD(GetConversionCount)(
+        VARTYPE vt,
+        ULONGLONG *pullToVariant,
+        ULONGLONG *pullFromVariant) = 0;
+
+    // clears every counter except APSL_COUNTER_WRAPPERS_ALIVE
+    STDMETHOD(ResetCounters)(VOID) = 0;
+};
+
+//////////////////////////////////////////////////////////////////////////
+//
+//  @enum APSL_PROFILE_VIEW
+//  @brief aggregation used by IaPSLScriptProfiler::GetProfile
+//
+enum APSL_PROFILE_VIEW
+{
+    APSL_PROFILE_FOLDED = 0,    // "frame;frame;frame samples" per line
+    APSL_PROFILE_LINES,         // "cookie:line samples", hottest first
+    APSL_PROFILE_FUNCTIONS      // "name samples", hottest first
+};
+
+//////////////////////////////////////////////////////////////////////////
+//
+//  @interface IaPSLScriptProfiler
+//  @brief timer driven sampling profiler attributing time to source lines
+//
+MIDL_INTERFACE("EEACE403-31E5-4F4A-8BC0-C64C0BD2931F")
+IaPSLScriptProfiler : public IUnknown
+{
+public:
+    STDMETHOD(StartProfiling)(ULONG ulIntervalMilliseconds) = 0;
+
+    STDMETHOD(StopProfiling)(VOID) = 0;
+
+    STDMETHOD(GetProfile)(
+        APSL_PROFILE_VIEW view,
+        BSTR *pbstrProfile) = 0;
+
+    STDMETHOD(ClearProfile)(VOID) = 0;
+};
+
+//////////////////////////////////////////////////////////////////////////
+//
+//  @interface IaPSLScriptHostNames
+//  @brief control over the engine's cache of host member names
+//
+//  The engine remembers both the DISPIDs a host object returned and the
+//  names it rejected; a rejected name becomes a script-side expando.
+//  Hosts that add or remove members at run time (IDispatchEx) call
+//  InvalidateMemberNames afterwards.
+//
+MIDL_INTERFACE("EA3287FD-8429-47A1-8DA0-0096D8F3A19E")
+IaPSLScriptHostNames : public IUnknown
+{
+public:
+    STDMETHOD(InvalidateMemberNames)(VOID) = 0;
+};
+
+//////////////////////////////////////////////////////////////////////////
+//
+//  @enum APSL_MEMBER_FLAGS
+//  @brief what the host promises about a member, by name
+//
+enum APSL_MEMBER_FLAGS
+{
+    APSL_MEMBER_DEFAULT         = 0x0000,
+    APSL_MEMBER_DEFERRABLE_PUT  = 0x0001,   // put has no side effects
+    APSL_MEMBER_IDEMPOTENT_GET  = 0x0002    // get returns the same value
+                                            // until the object is changed
+};
+
+//////////////////////////////////////////////////////////////////////////
+//
+//  @interface IaPSLScriptMemberHints
+//  @brief host declared member properties the engine may exploit
+//
+//  With write combining enabled, puts to APSL_MEMBER_DEFERRABLE_PUT
+//  members are queued per object, last write wins, and flushed in order
+//  at the next read of that object, at any host method call and before
+//  the engine leaves script.
+//
+//  Reads of APSL_MEMBER_IDEMPOTENT_GET members reach the host once per
+//  object per ParseScriptText (or RunDueTasks); a put or a method call
+//  on the object drops its cached reads.
+//
+MIDL_INTERFACE("C9458630-98AA-4B6E-980D-7F7ABA58ED20")
+IaPSLScriptMemberHints : public IUnknown
+{
+public:
+    STDMETHOD(SetMemberFlags)(
+        LPCOLESTR pstrName,
+        DWORD dwFlags) = 0;
+
+    STDMETHOD(GetMemberFlags)(
+        LPCOLESTR pstrName,
+        DWORD *pdwFlags) = 0;
+
+    STDMETHOD(EnableWriteCombining)(BOOL fEnable) = 0;
+};
+
+//////////////////////////////////////////////////////////////////////////
+//
+//  @interface IaPSLScriptMemory
+//  @brief memory charged to the engine and its hard limit
+//
+//  What is charged is everything the module allocates while the engine
+//  runs: PSL values and strings, wrappers on either side of the COM
+//  boundary and transcoded source.  The host's own allocations are not.
+//  While script code runs, an allocation past the quota first gives back
+//  the engine's cached reads and then fails, so a runaway loop stops
+//  where it allocates; the quota is also checked, after a full
+//  CollectGarbage, when a block starts and on every call into the host.
+//  The script is aborted, and ParseScriptText fails with
+//  DISP_E_EXCEPTION and an EXCEPINFO whose scode is E_OUTOFMEMORY.  A
+//  quota of 0 means unlimited.
+//
+MIDL_INTERFACE("A583B862-C357-47F3-987C-7769546AC8BC")
+IaPSLScriptMemory : public IUnknown
+{
+public:
+    STDMETHOD(GetMemoryUsage)(
+        ULONGLONG *pullCurrentBytes,
+        ULONGLONG *pullPeakBytes) = 0;
+
+    STDMETHOD(SetMemoryQuota)(ULONGLONG ullBytes) = 0;
+
+    STDMETHOD(GetMemoryQuota)(ULONGLONG *pullBytes) = 0;
+};
+
+//////////////////////////////////////////////////////////////////////////
+//
+//  @interface IaPSLScriptScheduler
+//  @brief pumps the engine's timers
+//
+//  Scripts schedule function callbacks with setTimeout and setInterval.
+//  The host calls RunDueTasks once per frame; every callback that has
+//  come due runs inside a single SCRIPTSTATE_STARTED window.
+//  GetNextDueTime returns INFINITE when no timer is pending.
+//
+MIDL_INTERFACE("305D22E4-E379-4B1A-961C-521275FC085A")
+IaPSLScriptScheduler : public IUnknown
+{
+public:
+    STDMETHOD(RunDueTasks)(
+        ULONG *pcTasksRun,
+        EXCEPINFO *pexcepinfo) = 0;
+
+    STDMETHOD(GetNextDueTime)(ULONG *pulMilliseconds) = 0;
+};
+
+//////////////////////////////////////////////////////////////////////////
+//
+//  @interface IaPSLScriptParseBatch
+//  @brief many script blocks in one execution window
+//
+//  Equivalent to one ParseScriptText call per block, in order, except
+//  that the site sees a single STARTED / OnLeaveScript / INITIALIZED
+//  sequence for the whole batch.  Blocks are transcoded one at a time on
+//  the calling thread, just before they run.  A failing block does
+//  not stop the ones after it; rghrResults and, when given, rgExcepinfo
+//  report each block as ParseScriptText would.  Returns S_FALSE when any
+//  block failed.  rgdwSourceContextCookie and rgulStartingLineNumber may
+//  be NULL.
+//
+MIDL_INTERFACE("9617FBEC-7F26-423D-AF84-C213221D7E65")
+IaPSLScriptParseBatch : public IUnknown
+{
+public:
+    STDMETHOD(ParseScriptTextBatch)(
+        ULONG cBlocks,
+        LPCOLESTR const *rgpstrCode,
+        DWORD const *rgdwSourceContextCookie,
+        ULONG const *rgulStartingLineNumber,
+        HRESULT *rghrResults,
+        EXCEPINFO *rgExcepinfo) = 0;
+};
+
+//////////////////////////////////////////////////////////////////////////
+//
+//  @interface IaPSLScriptReload
+//  @brief replaces a loaded script block in the live engine
+//
+//  Compares pstrCode with the block last parsed under
+//  dwSourceContextCookie and runs only the top-level function definitions
+//  that are new or differ, so globals, named items and caches survive.
+//  Other top-level statements are never run again; S_FALSE reports that
+//  some of them changed or that a definition was removed, so the engine
+//  is not in the state a fresh load would give.  A cookie with no earlier
+//  block loads pstrCode the way ParseScriptText does.
+//
+//  The engine keeps the text of every block parsed under a nonzero
+//  cookie; ForgetScriptText drops it once the host will not reload the
+//  block again.
+//
+MIDL_INTERFACE("96A33E84-030A-427D-AE10-70ACF55319A2")
+IaPSLScriptReload : public IUnknown
+{
+public:
+    STDMETHOD(ReloadScriptText)(
+        LPCOLESTR pstrCode,
+        DWORD dwSourceContextCookie,
+        ULONG ulStartingLineNumber,
+        ULONG *pcFunctionsReloaded,
+        EXCEPINFO *pexcepinfo) = 0;
+
+    // S_FALSE when nothing was kept for dwSourceContextCookie
+    STDMETHOD(ForgetScriptText)(
+        DWORD dwSourceContextCookie) = 0;
+};
+
+namespace aPSL {
+
+    class engine_stats;
+    class profiler;
+    class write_queue;
+    class memory_arena;
+    class timer_wheel;
+    class read_cache;
+    class host_names;
+    class name_registry;
+
+    //////////////////////////////////////////////////////////////////////
+    //
+    //  @class quota_exceeded
+    //  @brief thrown by an allocation or a safe point once the engine is
+    //         past its memory quota
+    //
+    class quota_exceeded
+    : public std::bad_alloc
+    {
+    public:
+        char const *what() const throw()
+        {
+            return "aPSL: script exceeded its memory quota";
+        }
+    };
+
+    //////////////////////////////////////////////////////////////////////
+    //
+    //  @class host_error
+    //  @brief a host object failed a call; aborts the running script
+    //
+    //  Members the host reports as absent read as nil instead, so probing
+    //  for optional members never throws.
+    //
+    class host_error
+    : public std::exception
+    {
+    public:
+        host_error(HRESULT hr, std::wstring const& description)
+        : hr_(hr)
+        , description_(description)
+        {
+        }
+
+        ~host_error() throw()
+        {
+        }
+
+        HRESULT hr() const throw()
+        {
+            return hr_;
+        }
+
+        wchar_t const *description() const throw()
+        {
+            return description_.c_str();
+        }
+
+        char const *what() const throw()
+        {
+            return "aPSL: host call failed";
+        }
+
+    private:
+        HRESULT hr_;
+        std::wstring description_;
+    };
+
+    //////////////////////////////////////////////////////////////////////
+    //
+    //  @class prepared_script
+    //  @brief narrowed script source together with its (cookie, line)
+    //
+    //  Immutable and reference counted; one instance may be handed to any
+    //  number of engines on any thread.  PSLVM compiles on load, so the
+    //  saving is the one-time transcoding and copy of the source.
+    //
+    class prepared_script
+    {
+    public:
+        explicit prepared_script(char const *text, DWORD cookie = 0, ULONG line = 0);
+        explicit prepared_script(LPCOLESTR text, DWORD cookie = 0, ULONG line = 0);
+        prepared_script(prepared_script const& other) throw();
+        prepared_script& operator = (prepared_script const& other) throw();
+        ~prepared_script() throw();
+
+        char const *text() const throw();
+        size_t length() const throw();
+        DWORD cookie() const throw();
+        ULONG line() const throw();
+
+    private:
+        struct body;
+        body *body_;
+    };
+
+    //////////////////////////////////////////////////////////////////////
+    //
+    //  @struct value_traits
+    //  @brief conversion between native values and PSL::variable
+    //
+    template <typename T>
+    struct value_traits;
+
+    template <>
+    struct value_traits<int>
+    {
+        static int from(PSL::variable const& v) { return v.operator int(); }
+        static PSL::variable *to(int x) { return new PSL::variable(x); }
+    };
+
+    template <>
+    struct value_traits<long>
+    {
+        static long from(PSL::variable const& v) { return v.operator int(); }
+        static PSL::variable *to(long x) { return new PSL::variable(int(x)); }
+    };
+
+    template <>
+    struct value_traits<bool>
+    {
+        static bool from(PSL::variable const& v) { return 0 != v.operator int(); }
+        static PSL::variable *to(bool x) { return new PSL::variable(x ? 1: 0); }
+    };
+
+    template <>
+    struct value_traits<double>
+    {
+        static double from(PSL::variable const& v) { return v.operator double(); }
+        static PSL::variable *to(double x) { return new PSL::variable(x); }
+    };
+
+    template <>
+    struct value_traits<PSL::string>
+    {
+        static PSL::string from(PSL::variable const& v) { return v.operator PSL::string(); }
+        static PSL::variable *to(PSL::string const& x) { return new PSL::variable(x); }
+    };
+
+    template <>
+    struct value_traits<std::string>
+    {
+        static std::string from(PSL::variable const& v) { return v.operator char const *(); }
+        static PSL::variable *to(std::string const& x) { return new PSL::variable(PSL::string(x.c_str())); }
+    };
+
+    template <>
+    struct value_traits<char const *>
+    {
+        static PSL::variable *to(char const *x) { return new PSL::variable(PSL::string(x)); }
+    };
+
+    template <>
+    struct value_traits<PSL::variable>
+    {
+        static PSL::variable from(PSL::variable const& v) { return v; }
+        static PSL::variable *to(PSL::variable const& x) { return new PSL::variable(x); }
+    };
+
+    namespace detail {
+
+        template <typename T> struct bare { typedef T type; };
+        template <typename T> struct bare<T const> { typedef T type; };
+        template <typename T> struct bare<T &> { typedef T type; };
+        template <typename T> struct bare<T const &> { typedef T type; };
+
+        // missing arguments read as NIL, as they do for script functions
+        template <typename A>
+        typename bare<A>::type argument(PSL::variable& arguments, size_t index)
+        {
+            typedef value_traits<typename bare<A>::type> traits;
+            if (index < arguments.length())
+                return traits::from(arguments[index]);
+            return traits::from(PSL::variable());
+        }
+
+        template <typename R>
+        struct invoker
+        {
+            static PSL::variable *invoke(R (*f)(), PSL::variable&)
+            {
+                return value_traits<typename bare<R>::type>::to(f());
+            }
+
+            template <typename A1>
+            static PSL::variable *invoke(R (*f)(A1), PSL::variable& args)
+            {
+                return value_traits<typename bare<R>::type>::to(
+                    f(argument<A1>(args, 0)));
+            }
+
+            template <typename A1, typename A2>
+            static PSL::variable *invoke(R (*f)(A1, A2), PSL::variable& args)
+            {
+                return value_traits<typename bare<R>::type>::to(
+                    f(argument<A1>(args, 0), argument<A2>(args, 1)));
+            }
+
+            template <typename A1, typename A2, typename A3>
+            static PSL::variable *invoke(R (*f)(A1, A2, A3), PSL::variable& args)
+            {
+                return value_traits<typename bare<R>::type>::to(
+                    f(argument<A1>(args, 0), argument<A2>(args, 1),
+                      argument<A3>(args, 2)));
+            }
+
+            template <typename A1, typename A2, typename A3, typename A4>
+            static PSL::variable *invoke(R (*f)(A1, A2, A3, A4), PSL::variable& args)
+            {
+                return value_traits<typename bare<R>::type>::to(
+                    f(argument<A1>(args, 0), argument<A2>(args, 1),
+                      argument<A3>(args, 2), argument<A4>(args, 3)));
+            }
+        };
+
+        template <>
+        struct invoker<void>
+        {
+            static PSL::variable *invoke(void (*f)(), PSL::variable&)
+            {
+                f();
+                return new PSL::variable; // NIL
+            }
+
+            template <typename A1>
+            static PSL::variable *invoke(void (*f)(A1), PSL::variable& args)
+            {
+                f(argument<A1>(args, 0));
+                return new PSL::variable; // NIL
+            }
+
+            template <typename A1, typename A2>
+            static PSL::variable *invoke(void (*f)(A1, A2), PSL::variable& args)
+            {
+                f(argument<A1>(args, 0), argument<A2>(args, 1));
+                return new PSL::variable; // NIL
+            }
+
+            template <typename A1, typename A2, typename A3>
+            static PSL::variable *invoke(void (*f)(A1, A2, A3), PSL::variable& args)
+            {
+                f(argument<A1>(args, 0), argument<A2>(args, 1),
+                  argument<A3>(args, 2));
+                return new PSL::variable; // NIL
+            }
+
+            template <typename A1, typename A2, typename A3, typename A4>
+            static PSL::variable *invoke(void (*f)(A1, A2, A3, A4), PSL::variable& args)
+            {
+                f(argument<A1>(args, 0), argument<A2>(args, 1),
+                  argument<A3>(args, 2), argument<A4>(args, 3));
+                return new PSL::variable; // NIL
+            }
+        };
+
+    } // namespace detail
+
+    //////////////////////////////////////////////////////////////////////
+    //
+    //  @class native_function
+    //  @brief script callable native function; F is a function pointer
+    //
+    template <typename R, typename F>
+    class native_function
+    : public PSL::variable
+    {
+    public:
+        explicit native_function(F f) throw()
+        : f_(f)
+        {
+        }
+
+        PSL::variable * __stdcall call__(PSL::variable& /*this_arg*/, PSL::variable& arguments)
+        {
+            return detail::invoker<R>::invoke(f_, arguments);
+        }
+
+    private:
+        F f_;
+    };
+
+    template <typename R>
+    PSL::variable *make_native_function(R (*f)())
+    {
+        return new native_function<R, R (*)()>(f);
+    }
+
+    template <typename R, typename A1>
+    PSL::variable *make_native_function(R (*f)(A1))
+    {
+        return new native_function<R, R (*)(A1)>(f);
+    }
+
+    template <typename R, typename A1, typename A2>
+    PSL::variable *make_native_function(R (*f)(A1, A2))
+    {
+        return new native_function<R, R (*)(A1, A2)>(f);
+    }
+
+    template <typename R, typename A1, typename A2, typename A3>
+    PSL::variable *make_native_function(R (*f)(A1, A2, A3))
+    {
+        return new native_function<R, R (*)(A1, A2, A3)>(f);
+    }
+
+    template <typename R, typename A1, typename A2, typename A3, typename A4>
+    PSL::variable *make_native_function(R (*f)(A1, A2, A3, A4))
+    {
+        return new native_function<R, R (*)(A1, A2, A3, A4)>(f);
+    }
+
+    //////////////////////////////////////////////////////////////////////
+    //
+    //  @class native_property
+    //  @brief script visible native variable
+    //
+    template <typename T>
+    class native_property
+    : public PSL::variable
+    {
+    public:
+        explicit native_property(T *p) throw()
+        : p_(p)
+        {
+        }
+
+        PSL::variable * __stdcall get_value__()
+        {
+            return value_traits<T>::to(*p_);
+        }
+
+        PSL::variable * __stdcall assign__(PSL::variable& rhs)
+        {
+            *p_ = value_traits<T>::from(rhs);
+            return rhs;
+        }
+
+    private:
+        T *p_;
+    };
+
+    //////////////////////////////////////////////////////////////////////
+    //
+    //  @class native_accessor
+    //  @brief script visible property backed by a getter and a setter
+    //
+    template <typename T>
+    class native_accessor
+    : public PSL::variable
+    {
+    public:
+        native_accessor(T (*getter)(), void (*setter)(T)) throw()
+        : getter_(getter)
+        , setter_(setter)
+        {
+        }
+
+        PSL::variable * __stdcall get_value__()
+        {
+            return value_traits<T>::to(getter_());
+        }
+
+        PSL::variable * __stdcall assign__(PSL::variable& rhs)
+        {
+            if (setter_)
+                setter_(value_traits<T>::from(rhs));
+            return rhs;
+        }
+
+    private:
+        T (*getter_)();
+        void (*setter_)(T);
+    };
+
+    //////////////////////////////////////////////////////////////////////
+    //
+    //  @class script_engine
+    //  @brief one PSL virtual machine; the native embedding API
+    //
+    //  CScriptObject is a COM adapter over this class.  Native hosts use
+    //  it directly and pass PSL::variable values without going through
+    //  VARIANT or IDispatch.
+    //
+    class script_engine
+    {
+    public:
+        //////////////////////////////////////////////////////////////////
+        //
+        //  @class scope
+        //  @brief makes the engine current on this thread
+        //
+        class scope
+        {
+        public:
+            explicit scope(script_engine& engine) throw();
+            ~scope() throw();
+
+        private:
+            script_engine *previous_;
+            memory_arena *previous_arena_;
+        };
+
+        script_engine();
+        ~script_engine() throw();
+
+        void eval(const char *text, DWORD cookie = 0, ULONG line = 0);
+
+        void run(prepared_script const& script);
+
+        // runs script and, for a nonzero cookie, keeps its text for
+        // reload in place of the block last loaded under that cookie
+        void load(prepared_script const& script);
+
+        // runs the function definitions of script that differ from the
+        // block last loaded under its cookie; false when other statements
+        // changed as well, which are left alone
+        bool reload(prepared_script const& script, size_t *reloaded = NULL);
+
+        // drops the text kept for cookie; false when there was none
+        bool forget(DWORD cookie) throw();
+
+        void put__(const PSL::string& pstrName, const PSL::variable& v);
+
+        // registers a native function, e.g. engine.def("add", &add)
+        template <typename F>
+        void def(PSL::string const& name, F f)
+        {
+            put__(name, *make_native_function(f));
+        }
+
+        // registers a native variable read and written in place
+        template <typename T>
+        void bind(PSL::string const& name, T *p)
+        {
+            put__(name, *new native_property<T>(p));
+        }
+
+        template <typename T>
+        void bind(PSL::string const& name, T (*getter)(), void (*setter)(T) = 0)
+        {
+            put__(name, *new native_accessor<T>(getter, setter));
+        }
+
+        void collect_garbage();
+
+        void memory_usage(ULONGLONG& current, ULONGLONG& peak) const throw();
+
+        // bytes; 0 means unlimited
+        void set_memory_quota(ULONGLONG quota) throw();
+
+        ULONGLONG memory_quota() const throw();
+
+        // collects, then throws quota_exceeded if the arena is still past
+        // its quota
+        void check_quota();
+
+        void set_member_flags(PSL::string const& name, DWORD flags);
+
+        DWORD member_flags(char const *name) const;
+
+        // turning it off flushes, and may throw as flush_writes does
+        void enable_write_combining(bool enable);
+
+        bool write_combining() const throw();
+
+        // queues a property put to a deferrable member; takes over value
+        void defer_put(IDispatch *pdisp, DISPID dispid, char const *name, VARIANT& value);
+
+        // pending puts to pdisp, or to every object when pdisp is NULL;
+        // every put is delivered, then host_error is thrown for the first
+        // one the host refused
+        void flush_writes(IDispatch *pdisp = NULL);
+
+        // true once any member is APSL_MEMBER_IDEMPOTENT_GET
+        bool read_caching() const throw();
+
+        // the value this run already read, or NULL
+        VARIANT const *cached_read(IDispatch *pdisp, DISPID dispid) const throw();
+
+        void cache_read(IDispatch *pdisp, DISPID dispid, VARIANT const& value);
+
+        // cached reads of pdisp, or of every object when pdisp is NULL
+        void invalidate_reads(IDispatch *pdisp = NULL) throw();
+
+        // a new reference to what this engine knows of the members of
+        // pdisp's object, shared by every live wrapper of that object
+        host_names *names_of(IDispatch *pdisp);
+
+        // forgets the DISPIDs looked up so far on every host object; for
+        // hosts whose members come and go (IDispatchEx)
+        void invalidate_names() throw();
+
+        LONG names_generation() const throw();
+
+        // calls callback after delay milliseconds, then every period
+        // milliseconds unless period is 0; returns an id for clear_timer
+        int set_timer(PSL::variable const& callback, ULONG delay, ULONG period = 0);
+
+        bool clear_timer(int id) throw();
+
+        // runs every callback that has come due; returns how many ran
+        size_t run_due_timers();
+
+        // milliseconds until the next timer may be due, or INFINITE
+        ULONG next_timer_due() const throw();
+
+        engine_stats& stats() const throw();
+
+        aPSL::profiler& profiler() const throw();
+
+        static script_engine *current() throw();
+
+    private:
+        script_engine(script_engine const&);
+        script_engine& operator = (script_engine const&);
+
+        void leave_script_after_error() throw();
+
+        engine_stats *stats_;
+        aPSL::profiler *profiler_;
+        write_queue *writes_;
+        timer_wheel *timers_;
+        read_cache *reads_;
+        name_registry *names_;
+        bool read_caching_;
+        memory_arena *arena_;
+        bool write_combining_;
+        std::map<std::string, DWORD> member_flags_;
+        std::map<DWORD, prepared_script> sources_;
+        PSL::PSLVM vm;
+    };
+
+    //////////////////////////////////////////////////////////////////////
+    //
+    //  @class batch_value
+    //  @brief nil, a number, a boolean or a string, held as a VARIANT
+    //
+    //  Script values may refer to objects of the engine that made them
+    //  and must not leave its thread; a batch_value is a deep copy of
+    //  plain data that may.  Objects and arrays are refused with
+    //  std::invalid_argument.
+    //
+    class batch_value
+    {
+    public:
+        batch_value() throw();
+        batch_value(int x) throw();
+        batch_value(double x) throw();
+        batch_value(bool x) throw();
+        batch_value(wchar_t const *x);
+        explicit batch_value(VARIANT const& v);
+        batch_value(batch_value const& other);
+        batch_value& operator = (batch_value const& other);
+        ~batch_value() throw();
+
+        VARIANT const& get() const throw();
+
+    private:
+        VARIANT v_;
+    };
+
+    //////////////////////////////////////////////////////////////////////
+    //
+    //  @struct batch_job
+    //  @brief a script and the globals it runs with
+    //
+    struct batch_job
+    {
+        typedef std::vector<std::pair<std::string, batch_value> > binding_list;
+
+        explicit batch_job(prepared_script const& script)
+        : script(script)
+        {
+        }
+
+        prepared_script script;
+        binding_list bindings;
+    };
+
+    //////////////////////////////////////////////////////////////////////
+    //
+    //  @struct batch_result
+    //  @brief what the job assigned to the global "result"
+    //
+    //  hr is DISP_E_TYPEMISMATCH when that was not plain data.
+    //
+    struct batch_result
+    {
+        batch_result()
+        : hr(E_PENDING)
+        {
+        }
+
+        batch_value value;
+        HRESULT hr;
+    };
+
+    //////////////////////////////////////////////////////////////////////
+    //
+    //  @class engine_pool
+    //  @brief runs independent jobs on one engine per worker thread
+    //
+    //  Jobs are split into contiguous runs, one per worker; a worker that
+    //  drains its own queue steals from the tail of the others.  Scripts
+    //  are shared read-only between workers.  Each job runs on an engine
+    //  of its own, so no global survives from one job to the next, and
+    //  bindings and results cross threads only as batch_value copies.
+    //  Results come back in job order.
+    //
+    //  A worker does not reuse its engine: PSLVM can rebind a global but
+    //  offers no way to remove one, so the globals and functions a script
+    //  defines itself would leak into the next job, and it keeps no
+    //  compiled form of a script to run again.  Every job therefore pays for a whole
+    //  script_engine (stats, profiler, timer wheel, built-ins and init)
+    //  and for compiling its text.  The pool.setup benchmark reports the
+    //  engine part per job next to the pool.N throughput; jobs that cost
+    //  about as much as that are better run in one engine.
+    //
+    class engine_pool
+    {
+    public:
+        typedef void (*initializer)(script_engine& engine);
+
+        // workers == 0 means one per processor; init runs on the fresh
+        // engine of every job, before its bindings
+        explicit engine_pool(size_t workers = 0, initializer init = 0);
+        ~engine_pool() throw();
+
+        size_t size() const throw();
+
+        void run(std::vector<batch_job> const& jobs, std::vector<batch_result>& results);
+
+    private:
+        struct worker;
+
+        engine_pool(engine_pool const&);
+        engine_pool& operator = (engine_pool const&);
+
+        static DWORD WINAPI worker_main(LPVOID param) throw();
+        bool next_job(worker& self, size_t& index) throw();
+        void execute(size_t index) throw();
+
+        std::vector<worker *> workers_;
+        initializer init_;
+        HANDLE done_event_;
+        LONG volatile active_;
+        bool volatile stopping_;
+        std::vector<batch_job> const *jobs_;
+        std::vector<batch_result> *results_;
+    };
+
+} // namespace aPSL
+
+#endif // APSL_H
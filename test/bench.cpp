@@ -0,0 +1,385 @@
+//////////////////////////////////////////////////////////////////////////
+//
+//  Portable benchmark of the engine behind a mock Active Scripting host
+//
+//  Every case is a script block handed to ParseScriptText, so it goes
+//  through the real transcoding, marshalling and wrapper code; only the
+//  host on the other side is a stand-in.  One JSON object per line is
+//  written to stdout.  Counter deltas are read through IaPSLScriptStats,
+//  outside the measured block, so reading them costs the case nothing.
+//
+#include "../aPSL.cpp"
+#include "host.h"
+
+namespace {
+
+    using harness::host_object;
+    using harness::json_line;
+
+    ULONG const ITERATIONS = 10000;
+
+    std::wstring number(ULONGLONG n)
+    {
+        return std::to_wstring(n);
+    }
+
+    std::wstring repeat(std::wstring const& s, size_t n)
+    {
+        std::wstring result;
+        result.reserve(s.length() * n);
+        for (size_t i = 0; i < n; ++i)
+            result += s;
+        return result;
+    }
+
+    std::wstring loop(std::wstring const& body, ULONG n)
+    {
+        return L"for (i = 0; i < " + number(n) + L"; i = i + 1) {\n" + body + L"\n}\n";
+    }
+
+    //////////////////////////////////////////////////////////////////////
+    //
+    //  @class fixture
+    //  @brief an engine whose site exposes window.bench
+    //
+    class fixture
+    {
+    public:
+        fixture()
+        : bench_(new host_object)
+        , engine_(NULL)
+        {
+            bench_->property(L"value", LONG(0));
+            bench_->property(L"str", std::wstring());
+            bench_->property(L"obj", static_cast<IDispatch *>(new host_object));
+            for (int n = 0; n <= 8; ++n)
+                bench_->method((L"f" + number(n)).c_str(), host_object::ARGUMENT_COUNT);
+            bench_->method(L"echo", host_object::ECHO);
+            host_object *window = new host_object;
+            bench_->AddRef();
+            window->property(L"bench", static_cast<IDispatch *>(bench_));
+            site_.add_item(L"window", window);
+            engine_ = new harness::script_host(site_);
+        }
+
+        ~fixture()
+        {
+            delete engine_;
+            bench_->Release();
+        }
+
+        host_object& bench() const throw()
+        {
+            return *bench_;
+        }
+
+        harness::script_host& engine() const throw()
+        {
+            return *engine_;
+        }
+
+        harness::host_site const& site() const throw()
+        {
+            return site_;
+        }
+
+    private:
+        fixture(fixture const&);
+        fixture& operator = (fixture const&);
+
+        harness::host_site site_;
+        host_object *bench_;
+        harness::script_host *engine_;
+    };
+
+    size_t const COUNTERS = sizeof(aPSL::counter_names) / sizeof(*aPSL::counter_names);
+
+    // runs code times times; operations is the count per run
+    void measure(fixture& f, char const *name, std::wstring const& code,
+                 ULONG operations, ULONG times = 1)
+    {
+        ULONGLONG before[COUNTERS];
+        for (size_t i = 0; i < COUNTERS; ++i)
+            before[i] = f.engine().counter(aPSL::counter_names[i].counter);
+        LONG const host_calls = f.bench().calls() + f.bench().gets() + f.bench().puts();
+
+        HRESULT hr = S_OK;
+        LONGLONG const start = aPSL::util::now_ticks();
+        for (ULONG n = 0; n < times && SUCCEEDED(hr); ++n)
+            hr = f.engine().parse(code);
+        ULONGLONG const elapsed = aPSL::util::ticks_to_microseconds(
+            aPSL::util::now_ticks() - start);
+
+        ULONGLONG const total = ULONGLONG(operations) * times;
+        json_line line(name);
+        line("operations", total)
+            ("microseconds", elapsed)
+            ("nanosecondsPerOperation", elapsed * 1000.0 / total)
+            ("bytes", ULONGLONG(code.length() * sizeof(OLECHAR)))
+            ("hostInvokes", ULONGLONG(f.bench().calls() + f.bench().gets()
+                                      + f.bench().puts() - host_calls));
+        for (size_t i = 0; i < COUNTERS; ++i)
+        {
+            ULONGLONG const after = f.engine().counter(aPSL::counter_names[i].counter);
+            if (APSL_COUNTER_WRAPPERS_ALIVE == aPSL::counter_names[i].counter)
+                line(aPSL::counter_names[i].name, after);
+            else
+                line(aPSL::counter_names[i].name, after - before[i]);
+        }
+        if (FAILED(hr))
+            line("hresult", ULONGLONG(ULONG(hr)));
+    }
+
+    // what the loop itself costs; subtract it from the per-operation cases
+    void bench_baseline(fixture& f)
+    {
+        measure(f, "loop.empty", loop(L"x = i", ITERATIONS), ITERATIONS);
+    }
+
+    void bench_parse(fixture& f)
+    {
+        static ULONG const sizes[] = {1024, 16384, 262144, 4194304};
+        for (size_t i = 0; i < sizeof(sizes) / sizeof(*sizes); ++i)
+        {
+            std::wstring const code = repeat(L"a = 1\n", sizes[i] / 6);
+            std::string const name = "parse." + std::to_string(sizes[i]);
+            measure(f, name.c_str(), code, 1, 4194304 / sizes[i] < 64 ? 4194304 / sizes[i]: 64);
+        }
+        // non-ASCII literals
+        measure(f, "parse.unicode.262144",
+                repeat(L"s = \"\x65e5\x672c\x8a9e\"\n", 262144 / 10), 1, 4);
+    }
+
+    void bench_members(fixture& f)
+    {
+        measure(f, "member.get", loop(L"x = window.bench.value", ITERATIONS), ITERATIONS);
+        measure(f, "member.put", loop(L"window.bench.value = i", ITERATIONS), ITERATIONS);
+        // optional members the host does not have read as nil
+        measure(f, "member.probe", loop(L"x = window.bench.missing", ITERATIONS), ITERATIONS);
+    }
+
+    // A probe of a member the host does not have, as the script sees it,
+    // and the same Invoke followed by the host_error unwind every miss
+    // used to take.  Both run against the wrapper directly, so only the
+    // failure path differs.
+    void bench_failed_probe()
+    {
+        host_object *object = new host_object;
+        {
+            aPSL::script_engine engine;
+            aPSL::script_engine::scope guard(engine);
+            aPSL::runtime_callable_wrapper missing(object, 99, "missing");
+
+            LONGLONG start = aPSL::util::now_ticks();
+            for (ULONG n = 0; n < ITERATIONS; ++n)
+                delete missing.get_value__();
+            ULONGLONG const result = aPSL::util::ticks_to_microseconds(
+                aPSL::util::now_ticks() - start);
+
+            start = aPSL::util::now_ticks();
+            for (ULONG n = 0; n < ITERATIONS; ++n)
+            {
+                DISPPARAMS params = {NULL, NULL, 0, 0};
+                aPSL::host_result failure;
+                aPSL::invoke_host(object, 99, DISPATCH_PROPERTYGET, params, failure);
+                try {
+                    aPSL::raise_host_error(failure, "missing");
+                }
+                catch (aPSL::host_error const&) {
+                }
+            }
+            ULONGLONG const unwind = aPSL::util::ticks_to_microseconds(
+                aPSL::util::now_ticks() - start);
+
+            json_line("probe.result")
+                ("operations", ULONGLONG(ITERATIONS))
+                ("microseconds", result)
+                ("nanosecondsPerOperation", result * 1000.0 / ITERATIONS);
+            json_line("probe.unwind")
+                ("operations", ULONGLONG(ITERATIONS))
+                ("microseconds", unwind)
+                ("nanosecondsPerOperation", unwind * 1000.0 / ITERATIONS);
+        }
+        object->Release();
+    }
+
+    void bench_calls(fixture& f)
+    {
+        std::wstring args;
+        for (int n = 0; n <= 8; ++n)
+        {
+            std::string const name = "call." + std::to_string(n);
+            measure(f, name.c_str(),
+                    loop(L"window.bench.f" + number(n) + L"(" + args + L")", ITERATIONS),
+                    ITERATIONS);
+            if (n)
+                args += L", ";
+            args += number(n + 1);
+        }
+    }
+
+    void bench_strings(fixture& f)
+    {
+        static ULONG const sizes[] = {16, 256, 4096, 65536};
+        for (size_t i = 0; i < sizeof(sizes) / sizeof(*sizes); ++i)
+        {
+            VARIANT value;
+            value.vt = VT_BSTR;
+            value.bstrVal = SysAllocStringLen(NULL, sizes[i]);
+            std::fill(value.bstrVal, value.bstrVal + sizes[i], L'x');
+            f.bench().property(L"str", value);
+            VariantClear(&value);
+            ULONG const n = ITERATIONS * 16 / sizes[i] < 10 ? 10: ITERATIONS * 16 / sizes[i];
+            std::string const name = "string." + std::to_string(sizes[i]);
+            measure(f, name.c_str(), loop(L"s = window.bench.echo(window.bench.str)", n), n);
+        }
+    }
+
+    void bench_wrappers(fixture& f)
+    {
+        measure(f, "wrapper.churn", loop(L"o = window.bench.obj", ITERATIONS), ITERATIONS);
+        IActiveScriptGarbageCollector *gc
+            = f.engine().query<IActiveScriptGarbageCollector>();
+        gc->CollectGarbage(SCRIPTGCTYPE_EXHAUSTIVE);
+        gc->Release();
+        measure(f, "wrapper.afterGC", L"o = 0", 1);
+    }
+
+    // puts to a host that answers every call after latency microseconds,
+    // as a proxy to another apartment does, written through and combined
+    void bench_write_combining(fixture& f)
+    {
+        ULONG const LATENCY = 50, PUTS = 1000;
+        IaPSLScriptMemberHints *hints = f.engine().query<IaPSLScriptMemberHints>();
+        hints->SetMemberFlags(L"value", APSL_MEMBER_DEFERRABLE_PUT);
+        hints->SetMemberFlags(L"str", APSL_MEMBER_DEFERRABLE_PUT);
+        std::wstring const code = loop(L"window.bench.value = i\nwindow.bench.str = \"s\"", PUTS);
+        f.bench().set_latency(LATENCY);
+        measure(f, "latency.put.direct", code, PUTS * 2);
+        hints->EnableWriteCombining(TRUE);
+        measure(f, "latency.put.combined", code, PUTS * 2);
+        hints->EnableWriteCombining(FALSE);
+        f.bench().set_latency(0);
+        hints->Release();
+    }
+
+    // many small blocks, one ParseScriptText each and then as one batch
+    void bench_batch(fixture& f)
+    {
+        ULONG const BLOCKS = 500;
+        std::vector<std::wstring> code(BLOCKS);
+        std::vector<LPCOLESTR> texts(BLOCKS);
+        std::vector<DWORD> cookies(BLOCKS);
+        std::vector<ULONG> lines(BLOCKS, 0);
+        for (ULONG i = 0; i < BLOCKS; ++i)
+        {
+            code[i] = L"b" + number(i) + L" = window.bench.value + " + number(i) + L"\n";
+            texts[i] = code[i].c_str();
+            cookies[i] = DWORD(i + 1);
+        }
+
+        LONG left = f.site().left();
+        LONGLONG start = aPSL::util::now_ticks();
+        for (ULONG i = 0; i < BLOCKS; ++i)
+            f.engine().parse(texts[i], NULL, cookies[i]);
+        ULONGLONG elapsed = aPSL::util::ticks_to_microseconds(aPSL::util::now_ticks() - start);
+        json_line("batch.sequential")
+            ("blocks", ULONGLONG(BLOCKS))
+            ("microseconds", elapsed)
+            ("leaveScripts", ULONGLONG(f.site().left() - left));
+
+        IaPSLScriptParseBatch *batch = f.engine().query<IaPSLScriptParseBatch>();
+        std::vector<HRESULT> results(BLOCKS);
+        left = f.site().left();
+        start = aPSL::util::now_ticks();
+        batch->ParseScriptTextBatch(BLOCKS, &texts[0], &cookies[0], &lines[0], &results[0], NULL);
+        elapsed = aPSL::util::ticks_to_microseconds(aPSL::util::now_ticks() - start);
+        batch->Release();
+        json_line("batch.single")
+            ("blocks", ULONGLONG(BLOCKS))
+            ("microseconds", elapsed)
+            ("leaveScripts", ULONGLONG(f.site().left() - left));
+    }
+
+    // what engine_pool spends on each job before its script is compiled:
+    // a fresh engine with its binding and result.  Compiling the text
+    // again for every job costs what parse.* reports on top.
+    double bench_pool_setup(std::vector<aPSL::batch_job> const& jobs)
+    {
+        PSL::variable value;
+        LONGLONG const start = aPSL::util::now_ticks();
+        for (size_t i = 0; i < jobs.size(); ++i)
+        {
+            aPSL::script_engine engine;
+            aPSL::script_engine::scope guard(engine);
+            PSL::variable *binding = aPSL::variant_to_variable(jobs[i].bindings[0].second.get());
+            engine.put__(jobs[i].bindings[0].first.c_str(), *binding);
+            delete binding;
+            engine.bind("result", &value);
+        }
+        ULONGLONG const elapsed = aPSL::util::ticks_to_microseconds(
+            aPSL::util::now_ticks() - start);
+        double const per_job = double(elapsed) / jobs.size();
+        json_line("pool.setup")
+            ("jobs", ULONGLONG(jobs.size()))
+            ("microseconds", elapsed)
+            ("microsecondsPerJob", per_job);
+        return per_job;
+    }
+
+    // jobs per second of an engine_pool, from one worker to one per
+    // processor, next to the per-job setup share of it
+    void bench_pool()
+    {
+        SYSTEM_INFO info;
+        GetSystemInfo(&info);
+        ULONG const JOBS = 2000;
+        aPSL::prepared_script const script(L"result = x * 2 + 1");
+        std::vector<aPSL::batch_job> jobs(JOBS, aPSL::batch_job(script));
+        for (ULONG i = 0; i < JOBS; ++i)
+            jobs[i].bindings.push_back(std::make_pair(std::string("x"), aPSL::batch_value(int(i))));
+        double const setup = bench_pool_setup(jobs);
+        for (DWORD threads = 1; ; threads *= 2)
+        {
+            if (threads > info.dwNumberOfProcessors)
+                threads = info.dwNumberOfProcessors;
+            aPSL::engine_pool pool(threads);
+            std::vector<aPSL::batch_result> results;
+            LONGLONG const start = aPSL::util::now_ticks();
+            pool.run(jobs, results);
+            ULONGLONG const elapsed = aPSL::util::ticks_to_microseconds(
+                aPSL::util::now_ticks() - start);
+            ULONGLONG failed = 0;
+            for (size_t i = 0; i < results.size(); ++i)
+                if (FAILED(results[i].hr))
+                    ++failed;
+            std::string const name = "pool." + std::to_string(threads);
+            json_line(name.c_str())
+                ("threads", ULONGLONG(threads))
+                ("jobs", ULONGLONG(JOBS))
+                ("microseconds", elapsed)
+                ("jobsPerSecond", elapsed ? JOBS * 1000000.0 / elapsed: 0.0)
+                ("setupMicrosecondsPerJob", setup)
+                ("failed", failed);
+            if (threads == info.dwNumberOfProcessors)
+                break;
+        }
+    }
+
+} // namespace
+
+int main()
+{
+    fixture f;
+    bench_baseline(f);
+    bench_parse(f);
+    bench_members(f);
+    bench_failed_probe();
+    bench_calls(f);
+    bench_strings(f);
+    bench_wrappers(f);
+    bench_write_combining(f);
+    bench_batch(f);
+    bench_pool();
+    return 0;
+}
@@ -0,0 +1,579 @@
+//////////////////////////////////////////////////////////////////////////
+//
+//  Portable checks of the engine behind a mock Active Scripting host
+//
+//  Each check prints one line, "ok name" or "FAIL name" after the
+//  failed conditions; the exit status is the number of failed checks.
+//
+#include "../aPSL.cpp"
+#include "host.h"
+
+namespace {
+
+    using harness::host_object;
+
+    int failed_conditions = 0;
+
+    void check(bool ok, char const *condition, int line)
+    {
+        if (ok)
+            return;
+        ++failed_conditions;
+        std::printf("check.cpp:%d: %s\n", line, condition);
+    }
+
+#define CHECK(x) check(!!(x), #x, __LINE__)
+
+    //////////////////////////////////////////////////////////////////////
+    //
+    //  @class leak_baseline
+    //  @brief live BSTRs and host objects when a check starts
+    //
+    class leak_baseline
+    {
+    public:
+        leak_baseline() throw()
+        : bstrs_(mock::live_bstrs())
+        , objects_(harness::live_objects())
+        {
+        }
+
+        bool balanced() const throw()
+        {
+            return bstrs_ == mock::live_bstrs() && objects_ == harness::live_objects();
+        }
+
+    private:
+        LONG bstrs_;
+        LONG objects_;
+    };
+
+    VARIANT string_variant(wchar_t const *text)
+    {
+        VARIANT v;
+        v.vt = VT_BSTR;
+        v.bstrVal = SysAllocString(text);
+        return v;
+    }
+
+    //////////////////////////////////////////////////////////////////////
+    //
+    //  leaks: every reference the engine takes on a host object and
+    //  every BSTR it allocates is gone again once the engine closes
+    //
+    void check_engine_releases_host_objects()
+    {
+        host_object *window = new host_object;
+        host_object *child = new host_object;
+        window->property(L"value", LONG(1));
+        window->property(L"text", std::wstring(L"text"));
+        child->AddRef();
+        window->property(L"child", static_cast<IDispatch *>(child));
+        window->method(L"echo", host_object::ECHO);
+        window->method(L"fail", host_object::FAILING);
+        window->AddRef();
+        LONG const bstrs = mock::live_bstrs();
+        {
+            harness::host_site site;
+            site.add_item(L"window", window);
+            LONG held;
+            {
+                harness::script_host engine(site);
+                // the global "window" is PSL's to hold until the engine closes
+                held = window->refcount();
+                engine.parse(L"x = window.value\nwindow.value = x + 1\n");
+                engine.parse(L"s = window.echo(window.text)\nc = window.child\n");
+                engine.parse(L"x = window.missing\nwindow.expando = 1\n");
+                engine.parse(L"window.fail(\"argument\")\n"); // fails, unwinds
+            }
+            CHECK(0 == site.refcount());
+            CHECK(window->refcount() <= held);
+            CHECK(2 == child->refcount());
+            CHECK(bstrs == mock::live_bstrs());
+        }
+        child->Release();
+        window->Release();
+    }
+
+    void check_conversions_balance_references()
+    {
+        leak_baseline const baseline;
+        host_object *object = new host_object;
+        {
+            aPSL::script_engine engine;
+            aPSL::script_engine::scope guard(engine);
+
+            SAFEARRAY *array = SafeArrayCreateVector(VT_VARIANT, 0, 2);
+            LONG index = 0;
+            aPSL::util::scoped_variant element(string_variant(L"element"));
+            SafeArrayPutElement(array, &index, &element.get());
+            index = 1;
+            VARIANT dispatch;
+            dispatch.vt = VT_DISPATCH;
+            dispatch.pdispVal = object;
+            SafeArrayPutElement(array, &index, &dispatch);
+
+            aPSL::util::scoped_variant values[3];
+            values[0].get() = string_variant(L"string");
+            values[1].get().vt = VT_DISPATCH;
+            values[1].get().pdispVal = object;
+            object->AddRef();
+            values[2].get().vt = VT_ARRAY | VT_VARIANT;
+            values[2].get().parray = array;
+
+            for (int round = 0; round < 100; ++round)
+                for (size_t i = 0; i < sizeof(values) / sizeof(*values); ++i)
+                {
+                    PSL::variable *value = aPSL::variant_to_variable(values[i].get());
+                    aPSL::util::scoped_variant back = aPSL::variable_to_variant(*value);
+                    delete value;
+                }
+        }
+        CHECK(1 == object->refcount());
+        object->Release();
+        CHECK(baseline.balanced());
+    }
+
+    // a DECIMAL that does not convert is an error, never 0
+    void check_bad_decimal_is_an_error()
+    {
+        aPSL::script_engine engine;
+        aPSL::script_engine::scope guard(engine);
+        VARIANT value;
+        ZeroMemory(&value, sizeof(value));
+        value.decVal.scale = 29;
+        value.decVal.Lo64 = 1;
+        value.vt = VT_DECIMAL;
+        HRESULT hr = S_OK;
+        try {
+            delete aPSL::variant_to_variable(value);
+        }
+        catch (aPSL::host_error const& e) {
+            hr = e.hr();
+        }
+        CHECK(DISP_E_OVERFLOW == hr);
+    }
+
+    void check_host_calls_release_arguments()
+    {
+        leak_baseline const baseline;
+        host_object *object = new host_object;
+        object->method(L"echo", host_object::ECHO);
+        object->method(L"fail", host_object::FAILING);
+        {
+            aPSL::script_engine engine;
+            aPSL::script_engine::scope guard(engine);
+            aPSL::runtime_callable_wrapper echo(object, 1, "echo");
+            aPSL::runtime_callable_wrapper fail(object, 2, "fail");
+            PSL::variable this_arg;
+            for (int round = 0; round < 100; ++round)
+            {
+                PSL::variable arguments(PSL::variable::RARRAY);
+                aPSL::util::scoped_variant text(string_variant(L"argument"));
+                arguments.push(aPSL::variant_to_variable(text.get()));
+                delete echo.call__(this_arg, arguments);
+                try {
+                    delete fail.call__(this_arg, arguments);
+                    CHECK(!"a failing host call returned");
+                }
+                catch (aPSL::host_error const& e) {
+                    CHECK(E_FAIL == e.hr());
+                }
+            }
+            CHECK(200 == object->calls());
+            // a member the host cannot call raises instead of reading nil
+            object->property(L"value", LONG(1));
+            aPSL::runtime_callable_wrapper value(object, 3, "value");
+            PSL::variable no_arguments(PSL::variable::RARRAY);
+            try {
+                delete value.call__(this_arg, no_arguments);
+                CHECK(!"calling a property returned");
+            }
+            catch (aPSL::host_error const& e) {
+                CHECK(DISP_E_MEMBERNOTFOUND == e.hr());
+            }
+        }
+        CHECK(1 == object->refcount());
+        object->Release();
+        CHECK(baseline.balanced());
+    }
+
+    //////////////////////////////////////////////////////////////////////
+    //
+    //  host names: rejected names and expandos belong to the object, not
+    //  to the wrapper that found them, while any wrapper of it lives; the
+    //  engine keeps no reference of its own
+    //
+    void check_names_outlive_wrappers()
+    {
+        leak_baseline const baseline;
+        host_object *object = new host_object;
+        object->property(L"value", LONG(1));
+        {
+            aPSL::script_engine engine;
+            aPSL::script_engine::scope guard(engine);
+            {
+                aPSL::activex_object first(object);
+                delete first.get__("value");
+                delete first.get__("missing");
+                first.put__("expando", new PSL::variable(7));
+                CHECK(3 == object->lookups());
+                {
+                    aPSL::activex_object second(object);
+                    delete second.get__("value");
+                    delete second.get__("missing");
+                    PSL::variable *expando = second.get__("expando");
+                    CHECK(7 == int(*expando));
+                    delete expando;
+                }
+                CHECK(3 == object->lookups());
+
+                engine.invalidate_names();
+                aPSL::activex_object third(object);
+                delete third.get__("value");
+                CHECK(4 == object->lookups());
+            }
+            // the last wrapper took the entry with it
+            CHECK(1 == object->refcount());
+            aPSL::activex_object fourth(object);
+            delete fourth.get__("value");
+            CHECK(5 == object->lookups());
+        }
+        CHECK(1 == object->refcount());
+        object->Release();
+        CHECK(baseline.balanced());
+    }
+
+    //////////////////////////////////////////////////////////////////////
+    //
+    //  write combining: a put the host refuses does not stop the rest,
+    //  and is raised where the queue is flushed
+    //
+    void check_refused_put_is_raised_at_flush()
+    {
+        leak_baseline const baseline;
+        host_object *object = new host_object;
+        object->method(L"method", host_object::ECHO);
+        object->property(L"value", LONG(0));
+        {
+            aPSL::script_engine engine;
+            aPSL::script_engine::scope guard(engine);
+            engine.set_member_flags("method", APSL_MEMBER_DEFERRABLE_PUT);
+            engine.set_member_flags("value", APSL_MEMBER_DEFERRABLE_PUT);
+            engine.enable_write_combining(true);
+            aPSL::activex_object wrapper(object);
+            wrapper.put__("method", new PSL::variable(1)); // not a property
+            wrapper.put__("value", new PSL::variable(2));
+            CHECK(0 == object->puts());
+            HRESULT hr = S_OK;
+            try {
+                engine.flush_writes();
+            }
+            catch (aPSL::host_error const& e) {
+                hr = e.hr();
+            }
+            CHECK(DISP_E_MEMBERNOTFOUND == hr);
+            CHECK(1 == object->puts());
+            CHECK(VT_I4 == object->value(L"value")->vt && 2 == object->value(L"value")->lVal);
+        }
+        CHECK(1 == object->refcount());
+        object->Release();
+        CHECK(baseline.balanced());
+    }
+
+    //////////////////////////////////////////////////////////////////////
+    //
+    //  timers: one cancelled by a callback due in the same tick never runs
+    //
+    int timer_ids[2];
+    int timers_fired;
+
+    void fire_first()
+    {
+        ++timers_fired;
+        aPSL::script_engine::current()->clear_timer(timer_ids[1]);
+    }
+
+    void fire_second()
+    {
+        ++timers_fired;
+        aPSL::script_engine::current()->clear_timer(timer_ids[0]);
+    }
+
+    void check_cleared_timer_never_fires()
+    {
+        aPSL::script_engine engine;
+        aPSL::script_engine::scope guard(engine);
+        timers_fired = 0;
+        timer_ids[0] = engine.set_timer(*aPSL::make_native_function(&fire_first), 1);
+        timer_ids[1] = engine.set_timer(*aPSL::make_native_function(&fire_second), 1);
+        while (0 != engine.next_timer_due())
+            Sleep(1);
+        Sleep(2); // both in the same tick
+        CHECK(1 == engine.run_due_timers());
+        CHECK(1 == timers_fired);
+        CHECK(INFINITE == engine.next_timer_due());
+    }
+
+    //////////////////////////////////////////////////////////////////////
+    //
+    //  memory quota: a loop that allocates without bound is stopped where
+    //  it allocates, not at the next call into the host
+    //
+    ULONGLONG const QUOTA = 1 << 20;
+    PSL::variable grown;
+
+    void grow_forever()
+    {
+        grown = PSL::variable(PSL::variable::RARRAY);
+        std::string const chunk(1024, 'x');
+        for (;;)
+            grown.push(new PSL::variable(chunk.c_str()));
+    }
+
+    void check_quota_stops_native_loop()
+    {
+        aPSL::script_engine engine;
+        aPSL::script_engine::scope guard(engine);
+        engine.set_memory_quota(QUOTA);
+        engine.set_timer(*aPSL::make_native_function(&grow_forever), 0);
+        while (0 != engine.next_timer_due())
+            Sleep(1);
+        bool stopped = false;
+        try {
+            engine.run_due_timers();
+        }
+        catch (aPSL::quota_exceeded const&) {
+            stopped = true;
+        }
+        CHECK(stopped);
+        ULONGLONG current = 0, peak = 0;
+        engine.memory_usage(current, peak);
+        CHECK(QUOTA / 2 < peak && peak <= QUOTA + 4096);
+        grown = PSL::variable();
+        engine.memory_usage(current, peak);
+        CHECK(current < QUOTA / 2);
+    }
+
+    void check_quota_stops_script_loop()
+    {
+        harness::host_site site;
+        harness::script_host host(site);
+        IaPSLScriptMemory *memory = host.query<IaPSLScriptMemory>();
+        memory->SetMemoryQuota(QUOTA);
+        memory->Release();
+        EXCEPINFO excepinfo;
+        ZeroMemory(&excepinfo, sizeof(excepinfo));
+        CHECK(DISP_E_EXCEPTION == host.parse(
+            L"s = \"\"\nwhile (1) s += \"x\"\n", &excepinfo));
+        CHECK(E_OUTOFMEMORY == excepinfo.scode);
+        SysFreeString(excepinfo.bstrSource);
+        SysFreeString(excepinfo.bstrDescription);
+        SysFreeString(excepinfo.bstrHelpFile);
+    }
+
+    //////////////////////////////////////////////////////////////////////
+    //
+    //  reload: whole top-level definitions are diffed, the rest of the
+    //  block is compared as a whole
+    //
+    void diff(char const *before, char const *after, aPSL::source_diff& result)
+    {
+        aPSL::diff_sources(aPSL::prepared_script(before, 1, 1),
+                           aPSL::prepared_script(after, 1, 1), result);
+    }
+
+    void check_reload_keeps_multiline_statements_whole()
+    {
+        char const *const before =
+            "total = 1 +\n"
+            "    scale(2)\n"
+            "add(a, b) {\n"
+            "    return a + b\n"
+            "}\n"
+            "config = make(\n"
+            "    \"name\",\n"
+            "    2)\n";
+        aPSL::source_diff result;
+        diff(before, before, result);
+        CHECK(0 == result.definitions && result.complete);
+
+        // the same statements laid out differently
+        diff(before,
+             "total = 1 +\n"
+             "  scale(2)\n"
+             "\n"
+             "add(a, b) {\n"
+             "    return a + b\n"
+             "}\n"
+             "config = make(\n"
+             "  \"name\",\n"
+             "  2)\n", result);
+        CHECK(0 == result.definitions && result.complete);
+
+        // a continuation line that looks like a call is not a definition
+        diff(before,
+             "total = 1 +\n"
+             "    scale(3)\n"
+             "add(a, b) {\n"
+             "    return a + b\n"
+             "}\n"
+             "config = make(\n"
+             "    \"name\",\n"
+             "    2)\n", result);
+        CHECK(0 == result.definitions && !result.complete);
+
+        diff(before,
+             "total = 1 +\n"
+             "    scale(2)\n"
+             "add(a, b) {\n"
+             "    return a - b\n"
+             "}\n"
+             "config = make(\n"
+             "    \"name\",\n"
+             "    2)\n", result);
+        CHECK(1 == result.definitions && result.complete);
+        CHECK(3 == result.line);
+        CHECK("add(a, b) {\n    return a - b\n}" == result.text);
+    }
+
+    void check_reload_takes_only_changed_definitions()
+    {
+        char const *const before =
+            "function a() { return 1 }\n"
+            "function b() {\n"
+            "    return 2\n"
+            "}\n"
+            "function c() { return \"}\" }\n";
+        aPSL::source_diff result;
+        diff(before,
+             "function a() { return 1 }\n"
+             "function b() {\n"
+             "    return 20\n"
+             "}\n"
+             "function c() { return \"}\" }\n"
+             "function d() { return 4 }\n", result);
+        CHECK(2 == result.definitions && result.complete);
+        CHECK(2 == result.line);
+        CHECK("function b() {\n    return 20\n}\n\nfunction d() { return 4 }" == result.text);
+
+        // a definition that is gone cannot be undone
+        diff(before,
+             "function a() { return 1 }\n"
+             "function c() { return \"}\" }\n", result);
+        CHECK(0 == result.definitions && !result.complete);
+    }
+
+    // only loaded blocks are kept, one per cookie, until forgotten
+    void check_reload_keeps_one_block_per_cookie()
+    {
+        std::string const text(4096, ' ');
+        aPSL::script_engine engine;
+        aPSL::script_engine::scope guard(engine);
+        ULONGLONG empty = 0, peak = 0;
+        engine.memory_usage(empty, peak);
+        engine.run(aPSL::prepared_script(text.c_str(), 7, 1));
+        CHECK(!engine.forget(7));
+
+        ULONGLONG once = 0, twice = 0, after = 0;
+        engine.load(aPSL::prepared_script(text.c_str(), 7, 1));
+        engine.memory_usage(once, peak);
+        engine.load(aPSL::prepared_script(text.c_str(), 7, 1));
+        engine.memory_usage(twice, peak);
+        CHECK(empty + text.size() <= once && once == twice);
+
+        CHECK(engine.forget(7));
+        CHECK(!engine.forget(7));
+        engine.memory_usage(after, peak);
+        CHECK(empty == after);
+    }
+
+    //////////////////////////////////////////////////////////////////////
+    //
+    //  engine_pool: every job on a fresh engine, plain data in and out
+    //
+    void check_batch_values_are_plain_copies()
+    {
+        LONG const bstrs = mock::live_bstrs();
+        {
+            aPSL::batch_value const text(L"text");
+            aPSL::batch_value const copy(text);
+            CHECK(VT_BSTR == copy.get().vt);
+            CHECK(text.get().bstrVal != copy.get().bstrVal);
+            CHECK(0 == wcscmp(L"text", copy.get().bstrVal));
+
+            host_object *object = new host_object;
+            VARIANT dispatch;
+            dispatch.vt = VT_DISPATCH;
+            dispatch.pdispVal = object;
+            bool refused = false;
+            try {
+                aPSL::batch_value value(dispatch);
+            }
+            catch (std::invalid_argument const&) {
+                refused = true;
+            }
+            CHECK(refused);
+            CHECK(1 == object->refcount());
+            object->Release();
+        }
+        CHECK(bstrs == mock::live_bstrs());
+    }
+
+    void check_pool_runs_jobs_in_order()
+    {
+        aPSL::prepared_script const script(L"result = x");
+        std::vector<aPSL::batch_job> jobs(64, aPSL::batch_job(script));
+        for (int i = 0; i < 64; ++i)
+            jobs[i].bindings.push_back(std::make_pair(std::string("x"), aPSL::batch_value(i)));
+        aPSL::engine_pool pool(4);
+        std::vector<aPSL::batch_result> results;
+        pool.run(jobs, results);
+        int wrong = 0;
+        for (int i = 0; i < int(results.size()); ++i)
+            if (S_OK != results[i].hr || VT_I4 != results[i].value.get().vt
+                || i != results[i].value.get().lVal)
+                ++wrong;
+        CHECK(64 == results.size());
+        CHECK(0 == wrong);
+    }
+
+    struct test_case
+    {
+        char const *name;
+        void (*run)();
+    };
+
+    test_case const checks[] = {
+        { "leak.engine", check_engine_releases_host_objects },
+        { "leak.conversions", check_conversions_balance_references },
+        { "conversions.badDecimal", check_bad_decimal_is_an_error },
+        { "leak.hostCalls", check_host_calls_release_arguments },
+        { "names.shared", check_names_outlive_wrappers },
+        { "writes.refused", check_refused_put_is_raised_at_flush },
+        { "timers.clearedInTick", check_cleared_timer_never_fires },
+        { "quota.nativeLoop", check_quota_stops_native_loop },
+        { "quota.scriptLoop", check_quota_stops_script_loop },
+        { "reload.multiline", check_reload_keeps_multiline_statements_whole },
+        { "reload.changedOnly", check_reload_takes_only_changed_definitions },
+        { "reload.forget", check_reload_keeps_one_block_per_cookie },
+        { "pool.plainData", check_batch_values_are_plain_copies },
+        { "pool.order", check_pool_runs_jobs_in_order },
+    };
+
+} // namespace
+
+int main()
+{
+    int failed = 0;
+    for (size_t i = 0; i < sizeof(checks) / sizeof(*checks); ++i)
+    {
+        int const before = failed_conditions;
+        checks[i].run();
+        bool const ok = before == failed_conditions;
+        std::printf("%s %s\n", ok ? "ok": "FAIL", checks[i].name);
+        if (!ok)
+            ++failed;
+    }
+    return failed;
+}
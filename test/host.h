@@ -0,0 +1,513 @@
+//////////////////////////////////////////////////////////////////////////
+//
+//  In-process stand-ins for an Active Scripting host
+//
+//  host_object is an IDispatch whose members are declared by the test;
+//  it counts every call made to it and can add a fixed latency to each,
+//  the way a cross-apartment proxy would.  host_site hands named items to
+//  the engine.  script_host owns one CScriptObject driven through the
+//  same COM interfaces a real host uses.  Include after aPSL.cpp.
+//
+#ifndef APSL_TEST_HOST_H
+#define APSL_TEST_HOST_H
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+namespace harness {
+
+    // host_object instances not yet released to 0, for leak checks
+    inline LONG volatile& live_objects()
+    {
+        static LONG volatile count = 0;
+        return count;
+    }
+
+    inline void spin(ULONG microseconds)
+    {
+        if (!microseconds)
+            return;
+        LONGLONG const start = aPSL::util::now_ticks();
+        while (aPSL::util::ticks_to_microseconds(aPSL::util::now_ticks() - start) < microseconds)
+            ;
+    }
+
+    //////////////////////////////////////////////////////////////////////
+    //
+    //  @class host_object
+    //  @brief counting IDispatch with test-declared members
+    //
+    class host_object
+    : public IDispatch
+    {
+    public:
+        enum kind
+        {
+            PROPERTY,       // get and put a VARIANT
+            ARGUMENT_COUNT, // method returning how many arguments it got
+            ECHO,           // method returning its first argument
+            FAILING         // method failing with DISP_E_EXCEPTION
+        };
+
+        host_object() throw()
+        : refcount_(1)
+        , latency_(0)
+        , lookups_(0)
+        , gets_(0)
+        , puts_(0)
+        , calls_(0)
+        {
+            InterlockedIncrement(&live_objects());
+        }
+
+        void property(wchar_t const *name, VARIANT const& value)
+        {
+            VariantCopy(&add(name, PROPERTY).value, const_cast<VARIANT *>(&value));
+        }
+
+        void property(wchar_t const *name, LONG value)
+        {
+            VARIANT& v = add(name, PROPERTY).value;
+            v.vt = VT_I4;
+            v.lVal = value;
+        }
+
+        void property(wchar_t const *name, std::wstring const& value)
+        {
+            VARIANT& v = add(name, PROPERTY).value;
+            v.vt = VT_BSTR;
+            v.bstrVal = SysAllocStringLen(value.c_str(), UINT(value.length()));
+        }
+
+        // takes over a reference to child
+        void property(wchar_t const *name, IDispatch *child)
+        {
+            VARIANT& v = add(name, PROPERTY).value;
+            v.vt = VT_DISPATCH;
+            v.pdispVal = child;
+        }
+
+        void method(wchar_t const *name, kind what)
+        {
+            add(name, what);
+        }
+
+        // busy-waits this long in every GetIDsOfNames and Invoke
+        void set_latency(ULONG microseconds) throw()
+        {
+            latency_ = microseconds;
+        }
+
+        LONG refcount() const throw() { return refcount_; }
+        LONG lookups() const throw() { return lookups_; }
+        LONG gets() const throw() { return gets_; }
+        LONG puts() const throw() { return puts_; }
+        LONG calls() const throw() { return calls_; }
+
+        // the value of a PROPERTY member, or NULL
+        VARIANT const *value(wchar_t const *name) const throw()
+        {
+            for (size_t i = 0; i < members_.size(); ++i)
+                if (members_[i].name == name)
+                    return &members_[i].value;
+            return NULL;
+        }
+
+        STDMETHOD(QueryInterface)(REFIID riid, void **ppv)
+        {
+            if (!ppv)
+                return E_POINTER;
+            if (!IsEqualGUID(riid, IID_IUnknown) && !IsEqualGUID(riid, IID_IDispatch))
+                return *ppv = NULL, E_NOINTERFACE;
+            AddRef();
+            return *ppv = static_cast<IDispatch *>(this), S_OK;
+        }
+
+        STDMETHOD_(ULONG, AddRef)()
+        {
+            return InterlockedIncrement(&refcount_);
+        }
+
+        STDMETHOD_(ULONG, Release)()
+        {
+            LONG const count = InterlockedDecrement(&refcount_);
+            if (0 == count)
+                delete this;
+            return count;
+        }
+
+        STDMETHOD(GetTypeInfoCount)(UINT *pctinfo)
+        {
+            return *pctinfo = 0, S_OK;
+        }
+
+        STDMETHOD(GetTypeInfo)(UINT, LCID, ITypeInfo **)
+        {
+            return E_NOTIMPL;
+        }
+
+        STDMETHOD(GetIDsOfNames)(REFIID, LPOLESTR *rgszNames, UINT cNames,
+                                 LCID, DISPID *rgDispId)
+        {
+            InterlockedIncrement(&lookups_);
+            spin(latency_);
+            HRESULT hr = S_OK;
+            for (UINT n = 0; n < cNames; ++n)
+            {
+                rgDispId[n] = DISPID_UNKNOWN;
+                for (size_t i = 0; i < members_.size(); ++i)
+                    if (members_[i].name == rgszNames[n])
+                        rgDispId[n] = DISPID(i + 1);
+                if (DISPID_UNKNOWN == rgDispId[n])
+                    hr = DISP_E_UNKNOWNNAME;
+            }
+            return hr;
+        }
+
+        STDMETHOD(Invoke)(DISPID dispIdMember, REFIID, LCID, WORD wFlags,
+                          DISPPARAMS *pDispParams, VARIANT *pVarResult,
+                          EXCEPINFO *pExcepInfo, UINT *)
+        {
+            spin(latency_);
+            if (dispIdMember < 1 || members_.size() < size_t(dispIdMember))
+                return DISP_E_MEMBERNOTFOUND;
+            member& m = members_[dispIdMember - 1];
+            if (wFlags & (DISPATCH_PROPERTYPUT | DISPATCH_PROPERTYPUTREF))
+            {
+                if (PROPERTY != m.what || 1 != pDispParams->cArgs)
+                    return DISP_E_MEMBERNOTFOUND;
+                InterlockedIncrement(&puts_);
+                return VariantCopy(&m.value, &pDispParams->rgvarg[0]);
+            }
+            if (PROPERTY == m.what)
+            {
+                if (0 == (wFlags & DISPATCH_PROPERTYGET))
+                    return DISP_E_MEMBERNOTFOUND;
+                InterlockedIncrement(&gets_);
+                return pVarResult ? VariantCopy(pVarResult, &m.value): S_OK;
+            }
+            if (0 == (wFlags & DISPATCH_METHOD))
+                return DISP_E_MEMBERNOTFOUND;
+            InterlockedIncrement(&calls_);
+            UINT const count = pDispParams ? pDispParams->cArgs: 0;
+            switch (m.what)
+            {
+            case ARGUMENT_COUNT:
+                if (pVarResult)
+                {
+                    pVarResult->vt = VT_I4;
+                    pVarResult->lVal = LONG(count);
+                }
+                return S_OK;
+
+            case ECHO:
+                if (pVarResult && count)
+                    return VariantCopy(pVarResult, &pDispParams->rgvarg[count - 1]);
+                return S_OK;
+
+            default:
+                if (pExcepInfo)
+                {
+                    ZeroMemory(pExcepInfo, sizeof(*pExcepInfo));
+                    pExcepInfo->scode = E_FAIL;
+                    pExcepInfo->bstrDescription = SysAllocString(L"host_object: failing");
+                }
+                return DISP_E_EXCEPTION;
+            }
+        }
+
+    private:
+        struct member
+        {
+            std::wstring name;
+            kind what;
+            VARIANT value;
+        };
+
+        ~host_object() throw()
+        {
+            for (size_t i = 0; i < members_.size(); ++i)
+                VariantClear(&members_[i].value);
+            InterlockedDecrement(&live_objects());
+        }
+
+        // redeclaring a member replaces it and keeps its DISPID
+        member& add(wchar_t const *name, kind what)
+        {
+            for (size_t i = 0; i < members_.size(); ++i)
+                if (members_[i].name == name)
+                {
+                    VariantClear(&members_[i].value);
+                    members_[i].what = what;
+                    return members_[i];
+                }
+            member m;
+            m.name = name;
+            m.what = what;
+            VariantInit(&m.value);
+            members_.push_back(m);
+            return members_.back();
+        }
+
+        host_object(host_object const&);
+        host_object& operator = (host_object const&);
+
+        LONG volatile refcount_;
+        ULONG latency_;
+        LONG volatile lookups_;
+        LONG volatile gets_;
+        LONG volatile puts_;
+        LONG volatile calls_;
+        std::vector<member> members_;
+    };
+
+    //////////////////////////////////////////////////////////////////////
+    //
+    //  @class host_site
+    //  @brief IActiveScriptSite handing out named host objects
+    //
+    //  Lives on the stack of the test; reference counts are kept only to
+    //  check that the engine balances them.
+    //
+    class host_site
+    : public IActiveScriptSite
+    {
+    public:
+        host_site() throw()
+        : refcount_(0)
+        , entered_(0)
+        , left_(0)
+        , state_(SCRIPTSTATE_UNINITIALIZED)
+        {
+        }
+
+        ~host_site() throw()
+        {
+            for (size_t i = 0; i < items_.size(); ++i)
+                items_[i].second->Release();
+        }
+
+        // takes over a reference to item
+        void add_item(wchar_t const *name, IDispatch *item)
+        {
+            items_.push_back(std::make_pair(std::wstring(name), item));
+        }
+
+        LONG refcount() const throw() { return refcount_; }
+        LONG left() const throw() { return left_; }
+        SCRIPTSTATE state() const throw() { return state_; }
+
+        STDMETHOD(QueryInterface)(REFIID riid, void **ppv)
+        {
+            if (!IsEqualGUID(riid, IID_IUnknown)
+                && !IsEqualGUID(riid, __uuidof(IActiveScriptSite)))
+                return *ppv = NULL, E_NOINTERFACE;
+            AddRef();
+            return *ppv = static_cast<IActiveScriptSite *>(this), S_OK;
+        }
+
+        STDMETHOD_(ULONG, AddRef)()
+        {
+            return InterlockedIncrement(&refcount_);
+        }
+
+        STDMETHOD_(ULONG, Release)()
+        {
+            return InterlockedDecrement(&refcount_);
+        }
+
+        STDMETHOD(GetLCID)(LCID *)
+        {
+            return E_NOTIMPL;
+        }
+
+        STDMETHOD(GetItemInfo)(LPCOLESTR pstrName, DWORD dwReturnMask,
+                               IUnknown **ppiunkItem, ITypeInfo **ppti)
+        {
+            if (ppti)
+                *ppti = NULL;
+            if (0 == (dwReturnMask & SCRIPTINFO_IUNKNOWN) || !ppiunkItem)
+                return E_INVALIDARG;
+            *ppiunkItem = NULL;
+            for (size_t i = 0; i < items_.size(); ++i)
+                if (items_[i].first == pstrName)
+                {
+                    items_[i].second->AddRef();
+                    return *ppiunkItem = items_[i].second, S_OK;
+                }
+            return TYPE_E_ELEMENTNOTFOUND;
+        }
+
+        STDMETHOD(GetDocVersionString)(BSTR *)
+        {
+            return E_NOTIMPL;
+        }
+
+        STDMETHOD(OnScriptTerminate)(VARIANT const *, EXCEPINFO const *)
+        {
+            return S_OK;
+        }
+
+        STDMETHOD(OnStateChange)(SCRIPTSTATE ssScriptState)
+        {
+            state_ = ssScriptState;
+            return S_OK;
+        }
+
+        STDMETHOD(OnScriptError)(IActiveScriptError *)
+        {
+            return S_OK;
+        }
+
+        STDMETHOD(OnEnterScript)()
+        {
+            ++entered_;
+            return S_OK;
+        }
+
+        STDMETHOD(OnLeaveScript)()
+        {
+            ++left_;
+            return S_OK;
+        }
+
+    private:
+        host_site(host_site const&);
+        host_site& operator = (host_site const&);
+
+        LONG volatile refcount_;
+        LONG entered_;
+        LONG left_;
+        SCRIPTSTATE state_;
+        std::vector<std::pair<std::wstring, IDispatch *> > items_;
+    };
+
+    //////////////////////////////////////////////////////////////////////
+    //
+    //  @class script_host
+    //  @brief one engine, set up the way an Active Scripting host does
+    //
+    class script_host
+    {
+    public:
+        explicit script_host(host_site& site)
+        : object_(new IUnknownImpl<CScriptObject>)
+        , script_(NULL)
+        , parse_(NULL)
+        {
+            object_->QueryInterface(__uuidof(IActiveScript),
+                                    reinterpret_cast<void **>(&script_));
+            object_->QueryInterface(__uuidof(IActiveScriptParse),
+                                    reinterpret_cast<void **>(&parse_));
+            script_->SetScriptSite(&site);
+            parse_->InitNew();
+        }
+
+        ~script_host() throw()
+        {
+            script_->Close();
+            parse_->Release();
+            script_->Release();
+            delete object_;
+        }
+
+        HRESULT parse(wchar_t const *code, EXCEPINFO *pexcepinfo = NULL, DWORD cookie = 0)
+        {
+            return parse_->ParseScriptText(
+                code, NULL, NULL, NULL, cookie, 0, 0, NULL, pexcepinfo);
+        }
+
+        HRESULT parse(std::wstring const& code, EXCEPINFO *pexcepinfo = NULL, DWORD cookie = 0)
+        {
+            return parse(code.c_str(), pexcepinfo, cookie);
+        }
+
+        IActiveScript *script() const throw()
+        {
+            return script_;
+        }
+
+        IActiveScriptParse *parser() const throw()
+        {
+            return parse_;
+        }
+
+        // an extension interface; the caller releases it
+        template <typename I>
+        I *query() const
+        {
+            I *p = NULL;
+            object_->QueryInterface(__uuidof(I), reinterpret_cast<void **>(&p));
+            return p;
+        }
+
+        ULONGLONG counter(APSL_COUNTER counter) const
+        {
+            IaPSLScriptStats *stats = query<IaPSLScriptStats>();
+            ULONGLONG value = 0;
+            stats->GetCounter(counter, &value);
+            stats->Release();
+            return value;
+        }
+
+    private:
+        script_host(script_host const&);
+        script_host& operator = (script_host const&);
+
+        IUnknownImpl<CScriptObject> *object_;
+        IActiveScript *script_;
+        IActiveScriptParse *parse_;
+    };
+
+    //////////////////////////////////////////////////////////////////////
+    //
+    //  @class json_line
+    //  @brief one result object written to stdout as a single line
+    //
+    class json_line
+    {
+    public:
+        explicit json_line(char const *name)
+        {
+            text_ = "{\"case\":\"";
+            text_ += name;
+            text_ += "\"";
+        }
+
+        json_line& operator () (char const *key, double value)
+        {
+            char buffer[64];
+            _snprintf_s(buffer, _TRUNCATE, "%.3f", value);
+            return raw(key, buffer);
+        }
+
+        json_line& operator () (char const *key, ULONGLONG value)
+        {
+            char buffer[32];
+            _snprintf_s(buffer, _TRUNCATE, "%I64u", value);
+            return raw(key, buffer);
+        }
+
+        ~json_line()
+        {
+            std::printf("%s}\n", text_.c_str());
+            std::fflush(stdout);
+        }
+
+    private:
+        json_line& raw(char const *key, char const *value)
+        {
+            text_ += ",\"";
+            text_ += key;
+            text_ += "\":";
+            text_ += value;
+            return *this;
+        }
+
+        std::string text_;
+    };
+
+} // namespace harness
+
+#endif // APSL_TEST_HOST_H
@@ -0,0 +1,98 @@
+//////////////////////////////////////////////////////////////////////////
+//
+//  Active Scripting interfaces for the portable test harness
+//
+#ifndef APSL_MOCK_ACTIVSCP_H
+#define APSL_MOCK_ACTIVSCP_H
+
+#include "objbase.h"
+
+typedef enum tagSCRIPTSTATE
+{
+    SCRIPTSTATE_UNINITIALIZED = 0,
+    SCRIPTSTATE_INITIALIZED = 5,
+    SCRIPTSTATE_STARTED = 1,
+    SCRIPTSTATE_CONNECTED = 2,
+    SCRIPTSTATE_DISCONNECTED = 3,
+    SCRIPTSTATE_CLOSED = 4
+} SCRIPTSTATE;
+
+typedef enum tagSCRIPTTHREADSTATE
+{
+    SCRIPTTHREADSTATE_NOTINSCRIPT = 0,
+    SCRIPTTHREADSTATE_RUNNING = 1
+} SCRIPTTHREADSTATE;
+
+typedef enum tagSCRIPTGCTYPE
+{
+    SCRIPTGCTYPE_NORMAL = 0,
+    SCRIPTGCTYPE_EXHAUSTIVE = 1
+} SCRIPTGCTYPE;
+
+typedef DWORD SCRIPTTHREADID;
+
+#define SCRIPTINFO_IUNKNOWN 0x00000001
+#define SCRIPTINFO_ITYPEINFO 0x00000002
+#define SCRIPTITEM_ISVISIBLE 0x00000002
+#define SCRIPTITEM_ISSOURCE 0x00000004
+#define SCRIPTITEM_GLOBALMEMBERS 0x00000008
+#define SCRIPTTEXT_ISVISIBLE 0x00000002
+#define SCRIPTTEXT_ISEXPRESSION 0x00000020
+
+struct IActiveScriptError;
+
+MIDL_INTERFACE("DB01A1E3-A42B-11cf-8F20-00805F2CD064")
+IActiveScriptSite : public IUnknown
+{
+    STDMETHOD(GetLCID)(LCID *plcid) PURE;
+    STDMETHOD(GetItemInfo)(LPCOLESTR pstrName, DWORD dwReturnMask,
+                           IUnknown **ppiunkItem, ITypeInfo **ppti) PURE;
+    STDMETHOD(GetDocVersionString)(BSTR *pbstrVersion) PURE;
+    STDMETHOD(OnScriptTerminate)(VARIANT const *pvarResult, EXCEPINFO const *pexcepinfo) PURE;
+    STDMETHOD(OnStateChange)(SCRIPTSTATE ssScriptState) PURE;
+    STDMETHOD(OnScriptError)(IActiveScriptError *pscripterror) PURE;
+    STDMETHOD(OnEnterScript)() PURE;
+    STDMETHOD(OnLeaveScript)() PURE;
+};
+
+MIDL_INTERFACE("BB1A2AE1-A4F9-11cf-8F20-00805F2CD064")
+IActiveScript : public IUnknown
+{
+    STDMETHOD(SetScriptSite)(IActiveScriptSite *pass) PURE;
+    STDMETHOD(GetScriptSite)(REFIID riid, void **ppvObject) PURE;
+    STDMETHOD(SetScriptState)(SCRIPTSTATE ss) PURE;
+    STDMETHOD(GetScriptState)(SCRIPTSTATE *pssState) PURE;
+    STDMETHOD(Close)() PURE;
+    STDMETHOD(AddNamedItem)(LPCOLESTR pstrName, DWORD dwFlags) PURE;
+    STDMETHOD(AddTypeLib)(REFGUID rguidTypeLib, DWORD dwMajor, DWORD dwMinor, DWORD dwFlags) PURE;
+    STDMETHOD(GetScriptDispatch)(LPCOLESTR pstrItemName, IDispatch **ppdisp) PURE;
+    STDMETHOD(GetCurrentScriptThreadID)(SCRIPTTHREADID *pstidThread) PURE;
+    STDMETHOD(GetScriptThreadID)(DWORD dwWin32ThreadId, SCRIPTTHREADID *pstidThread) PURE;
+    STDMETHOD(GetScriptThreadState)(SCRIPTTHREADID stidThread, SCRIPTTHREADSTATE *pstsState) PURE;
+    STDMETHOD(InterruptScriptThread)(SCRIPTTHREADID stidThread, EXCEPINFO const *pexcepinfo,
+                                     DWORD dwFlags) PURE;
+    STDMETHOD(Clone)(IActiveScript **ppscript) PURE;
+};
+
+MIDL_INTERFACE("BB1A2AE2-A4F9-11cf-8F20-00805F2CD064")
+IActiveScriptParse : public IUnknown
+{
+    STDMETHOD(InitNew)() PURE;
+    STDMETHOD(AddScriptlet)(LPCOLESTR pstrDefaultName, LPCOLESTR pstrCode,
+                            LPCOLESTR pstrItemName, LPCOLESTR pstrSubItemName,
+                            LPCOLESTR pstrEventName, LPCOLESTR pstrDelimiter,
+                            DWORD dwSourceContextCookie, ULONG ulStartingLineNumber,
+                            DWORD dwFlags, BSTR *pbstrName, EXCEPINFO *pexcepinfo) PURE;
+    STDMETHOD(ParseScriptText)(LPCOLESTR pstrCode, LPCOLESTR pstrItemName,
+                               IUnknown *punkContext, LPCOLESTR pstrDelimiter,
+                               DWORD dwSourceContextCookie, ULONG ulStartingLineNumber,
+                               DWORD dwFlags, VARIANT *pvarResult, EXCEPINFO *pexcepinfo) PURE;
+};
+
+MIDL_INTERFACE("6AA2C4A0-2B53-11d4-A2A0-00104BD35090")
+IActiveScriptGarbageCollector : public IUnknown
+{
+    STDMETHOD(CollectGarbage)(SCRIPTGCTYPE scriptgctype) PURE;
+};
+
+#endif // APSL_MOCK_ACTIVSCP_H
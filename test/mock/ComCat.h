@@ -0,0 +1,13 @@
+//////////////////////////////////////////////////////////////////////////
+//
+//  component categories for the portable test harness; registration
+//  is left out of APSL_STATIC builds, so only the types are needed
+//
+#ifndef APSL_MOCK_COMCAT_H
+#define APSL_MOCK_COMCAT_H
+
+#include "objbase.h"
+
+typedef GUID CATID;
+
+#endif // APSL_MOCK_COMCAT_H
@@ -0,0 +1,33 @@
+//////////////////////////////////////////////////////////////////////////
+//
+//  IDispatchEx for the portable test harness
+//
+#ifndef APSL_MOCK_DISPEX_H
+#define APSL_MOCK_DISPEX_H
+
+#include "objbase.h"
+
+#define fdexNameCaseSensitive 0x00000001L
+#define fdexNameEnsure 0x00000002L
+#define fdexNameImplicit 0x00000004L
+#define fdexNameCaseInsensitive 0x00000008L
+#define fdexEnumDefault 0x00000001L
+#define fdexEnumAll 0x00000002L
+
+MIDL_INTERFACE("A6EF9860-C720-11d0-9337-00A0C90DCAA9")
+IDispatchEx : public IDispatch
+{
+    STDMETHOD(GetDispID)(BSTR bstrName, DWORD grfdex, DISPID *pid) PURE;
+    STDMETHOD(InvokeEx)(DISPID id, LCID lcid, WORD wFlags, DISPPARAMS *pdp,
+                        VARIANT *pvarRes, EXCEPINFO *pei, IServiceProvider *pspCaller) PURE;
+    STDMETHOD(DeleteMemberByName)(BSTR bstrName, DWORD grfdex) PURE;
+    STDMETHOD(DeleteMemberByDispID)(DISPID id) PURE;
+    STDMETHOD(GetMemberProperties)(DISPID id, DWORD grfdexFetch, DWORD *pgrfdex) PURE;
+    STDMETHOD(GetMemberName)(DISPID id, BSTR *pbstrName) PURE;
+    STDMETHOD(GetNextDispID)(DWORD grfdex, DISPID id, DISPID *pid) PURE;
+    STDMETHOD(GetNameSpaceParent)(IUnknown **ppunk) PURE;
+};
+
+#define IID_IDispatchEx __uuidof(IDispatchEx)
+
+#endif // APSL_MOCK_DISPEX_H
@@ -0,0 +1,11 @@
+//////////////////////////////////////////////////////////////////////////
+//
+//  comdef.h for the portable test harness; aPSL needs nothing from the
+//  compiler COM support classes beyond the base headers
+//
+#ifndef APSL_MOCK_COMDEF_H
+#define APSL_MOCK_COMDEF_H
+
+#include "objbase.h"
+
+#endif // APSL_MOCK_COMDEF_H
@@ -0,0 +1,597 @@
+//////////////////////////////////////////////////////////////////////////
+//
+//  COM and OLE Automation stand-in for the portable test harness
+//
+//  GUIDs, IUnknown, IDispatch, IEnumVARIANT, BSTR, VARIANT and one
+//  dimensional SAFEARRAYs.  __uuidof gives every interface type a GUID
+//  of its own, made up on first use.  BSTRs are counted so that tests
+//  can check that nothing leaks; see mock::live_bstrs().
+//
+#ifndef APSL_MOCK_OBJBASE_H
+#define APSL_MOCK_OBJBASE_H
+
+#include "windows.h"
+
+#define interface struct
+#define MIDL_INTERFACE(x) struct
+#define PURE = 0
+#define STDMETHOD(method) virtual HRESULT STDMETHODCALLTYPE method
+#define STDMETHOD_(type, method) virtual type STDMETHODCALLTYPE method
+#define STDMETHODIMP HRESULT STDMETHODCALLTYPE
+#define STDMETHODIMP_(type) type STDMETHODCALLTYPE
+#define STDAPI extern "C" HRESULT STDAPICALLTYPE
+
+#define SUCCEEDED(hr) (HRESULT(hr) >= 0)
+#define FAILED(hr) (HRESULT(hr) < 0)
+#define MAKE_HRESULT(severity, facility, code) \
+    HRESULT((ULONG(severity) << 31) | (ULONG(facility) << 16) | ULONG(code))
+#define HRESULT_FROM_WIN32(x) \
+    (HRESULT(x) <= 0 ? HRESULT(x): HRESULT((ULONG(x) & 0x0000FFFF) | 0x80070000UL))
+
+#define S_OK                    HRESULT(0)
+#define S_FALSE                 HRESULT(1)
+#define E_NOTIMPL               HRESULT(0x80004001UL)
+#define E_NOINTERFACE           HRESULT(0x80004002UL)
+#define E_POINTER               HRESULT(0x80004003UL)
+#define E_ABORT                 HRESULT(0x80004004UL)
+#define E_FAIL                  HRESULT(0x80004005UL)
+#define E_PENDING               HRESULT(0x8000000AUL)
+#define E_UNEXPECTED            HRESULT(0x8000FFFFUL)
+#define E_ACCESSDENIED          HRESULT(0x80070005UL)
+#define E_OUTOFMEMORY           HRESULT(0x8007000EUL)
+#define E_INVALIDARG            HRESULT(0x80070057UL)
+#define DISP_E_UNKNOWNINTERFACE HRESULT(0x80020001UL)
+#define DISP_E_MEMBERNOTFOUND   HRESULT(0x80020003UL)
+#define DISP_E_PARAMNOTFOUND    HRESULT(0x80020004UL)
+#define DISP_E_TYPEMISMATCH     HRESULT(0x80020005UL)
+#define DISP_E_UNKNOWNNAME      HRESULT(0x80020006UL)
+#define DISP_E_EXCEPTION        HRESULT(0x80020009UL)
+#define DISP_E_OVERFLOW         HRESULT(0x8002000AUL)
+#define DISP_E_BADINDEX         HRESULT(0x8002000BUL)
+#define DISP_E_BADPARAMCOUNT    HRESULT(0x8002000EUL)
+#define DISP_E_BADVARTYPE       HRESULT(0x80020008UL)
+#define CLASS_E_NOAGGREGATION   HRESULT(0x80040110UL)
+#define TYPE_E_ELEMENTNOTFOUND  HRESULT(0x8002802BUL)
+
+typedef LONG SCODE;
+typedef DWORD LCID;
+typedef LONG DISPID;
+typedef DISPID MEMBERID;
+typedef unsigned short VARTYPE;
+typedef short VARIANT_BOOL;
+typedef double DATE;
+typedef wchar_t OLECHAR, *LPOLESTR, *BSTR;
+typedef wchar_t const *LPCOLESTR;
+
+// expands a macro argument first, as the real OLESTR does
+#define OLESTR(s) APSL_MOCK_OLESTR(s)
+#define APSL_MOCK_OLESTR(s) L##s
+#define LOCALE_USER_DEFAULT 0x0400
+#define VARIANT_TRUE VARIANT_BOOL(-1)
+#define VARIANT_FALSE VARIANT_BOOL(0)
+
+#define DISPID_VALUE 0
+#define DISPID_UNKNOWN (-1)
+#define DISPID_PROPERTYPUT (-3)
+#define DISPID_NEWENUM (-4)
+#define DISPID_STARTENUM DISPID_UNKNOWN
+
+#define DISPATCH_METHOD 0x1
+#define DISPATCH_PROPERTYGET 0x2
+#define DISPATCH_PROPERTYPUT 0x4
+#define DISPATCH_PROPERTYPUTREF 0x8
+
+//////////////////////////////////////////////////////////////////////////
+//
+//  GUIDs
+//
+typedef struct _GUID
+{
+    ULONG Data1;
+    USHORT Data2;
+    USHORT Data3;
+    BYTE Data4[8];
+} GUID, IID, CLSID;
+typedef GUID const& REFGUID;
+typedef GUID const& REFIID;
+typedef GUID const& REFCLSID;
+
+inline bool operator == (GUID const& lhs, GUID const& rhs)
+{
+    return 0 == memcmp(&lhs, &rhs, sizeof(GUID));
+}
+
+inline bool operator != (GUID const& lhs, GUID const& rhs)
+{
+    return !(lhs == rhs);
+}
+
+inline BOOL IsEqualGUID(REFGUID lhs, REFGUID rhs) { return lhs == rhs; }
+inline BOOL IsEqualIID(REFIID lhs, REFIID rhs) { return lhs == rhs; }
+inline BOOL IsEqualCLSID(REFCLSID lhs, REFCLSID rhs) { return lhs == rhs; }
+
+namespace mock {
+
+    inline GUID make_guid()
+    {
+        static LONG volatile next = 0;
+        GUID guid = { ULONG(InterlockedIncrement(&next)), 0xA951, 0x4C0A,
+                      { 0x8B, 0x11, 0x6D, 0x0C, 0x0A, 0x95, 0x1C, 0x0D } };
+        return guid;
+    }
+
+    template <class T>
+    inline GUID const& uuid_of()
+    {
+        static GUID const guid = make_guid();
+        return guid;
+    }
+
+    inline GUID const& null_guid()
+    {
+        static GUID const guid = GUID();
+        return guid;
+    }
+
+} // namespace mock
+
+#define __uuidof(type) (::mock::uuid_of<type>())
+#define IID_NULL (::mock::null_guid())
+#define IID_IUnknown __uuidof(IUnknown)
+#define IID_IDispatch __uuidof(IDispatch)
+#define IID_IEnumVARIANT __uuidof(IEnumVARIANT)
+#define IID_IClassFactory __uuidof(IClassFactory)
+
+//////////////////////////////////////////////////////////////////////////
+//
+//  BSTR
+//
+namespace mock {
+
+    inline LONG volatile& bstr_count()
+    {
+        static LONG volatile count = 0;
+        return count;
+    }
+
+    // BSTRs allocated and not yet freed
+    inline LONG live_bstrs()
+    {
+        return bstr_count();
+    }
+
+} // namespace mock
+
+inline BSTR SysAllocStringLen(OLECHAR const *source, UINT length)
+{
+    // the length prefix sits right before the characters, as in OLE
+    UINT *block = static_cast<UINT *>(malloc(sizeof(UINT) * 2 + (length + 1) * sizeof(OLECHAR)));
+    if (!block)
+        return NULL;
+    block[1] = UINT(length * sizeof(OLECHAR));
+    BSTR result = reinterpret_cast<BSTR>(block + 2);
+    if (source)
+        memcpy(result, source, length * sizeof(OLECHAR));
+    else
+        memset(result, 0, length * sizeof(OLECHAR));
+    result[length] = 0;
+    InterlockedIncrement(&mock::bstr_count());
+    return result;
+}
+
+inline BSTR SysAllocString(OLECHAR const *source)
+{
+    return source ? SysAllocStringLen(source, UINT(wcslen(source))): NULL;
+}
+
+inline void SysFreeString(BSTR s)
+{
+    if (!s)
+        return;
+    InterlockedDecrement(&mock::bstr_count());
+    free(reinterpret_cast<UINT *>(s) - 2);
+}
+
+inline UINT SysStringByteLen(BSTR s)
+{
+    return s ? reinterpret_cast<UINT *>(s)[-1]: 0;
+}
+
+inline UINT SysStringLen(BSTR s)
+{
+    return SysStringByteLen(s) / sizeof(OLECHAR);
+}
+
+//////////////////////////////////////////////////////////////////////////
+//
+//  IUnknown, interfaces used by VARIANT
+//
+struct ITypeInfo;
+struct IRecordInfo;
+
+MIDL_INTERFACE("00000000-0000-0000-C000-000000000046")
+IUnknown
+{
+    virtual ~IUnknown() {}
+    STDMETHOD(QueryInterface)(REFIID riid, void **ppvObject) PURE;
+    STDMETHOD_(ULONG, AddRef)() PURE;
+    STDMETHOD_(ULONG, Release)() PURE;
+};
+typedef IUnknown *LPUNKNOWN;
+
+//////////////////////////////////////////////////////////////////////////
+//
+//  VARIANT and SAFEARRAY
+//
+enum VARENUM
+{
+    VT_EMPTY = 0, VT_NULL = 1, VT_I2 = 2, VT_I4 = 3, VT_R4 = 4, VT_R8 = 5,
+    VT_CY = 6, VT_DATE = 7, VT_BSTR = 8, VT_DISPATCH = 9, VT_ERROR = 10,
+    VT_BOOL = 11, VT_VARIANT = 12, VT_UNKNOWN = 13, VT_DECIMAL = 14,
+    VT_I1 = 16, VT_UI1 = 17, VT_UI2 = 18, VT_UI4 = 19, VT_I8 = 20,
+    VT_UI8 = 21, VT_INT = 22, VT_UINT = 23, VT_VOID = 24, VT_HRESULT = 25,
+    VT_RECORD = 36, VT_CLSID = 72,
+    VT_ARRAY = 0x2000, VT_BYREF = 0x4000, VT_TYPEMASK = 0xFFF
+};
+
+typedef union tagCY
+{
+    struct { ULONG Lo; LONG Hi; };
+    LONGLONG int64;
+} CY;
+
+#define DECIMAL_NEG ((BYTE)0x80)
+
+typedef struct tagDEC
+{
+    USHORT wReserved;
+    BYTE scale;
+    BYTE sign;
+    ULONG Hi32;
+    ULONGLONG Lo64;
+} DECIMAL;
+
+typedef struct tagSAFEARRAYBOUND
+{
+    ULONG cElements;
+    LONG lLbound;
+} SAFEARRAYBOUND;
+
+typedef struct tagSAFEARRAY
+{
+    USHORT cDims;
+    USHORT fFeatures;
+    ULONG cbElements;
+    ULONG cLocks;
+    PVOID pvData;
+    SAFEARRAYBOUND rgsabound[1];
+    VARTYPE vt; // stand-in only: the element type
+} SAFEARRAY, *LPSAFEARRAY;
+
+struct IDispatch;
+
+typedef struct tagVARIANT
+{
+    union
+    {
+        struct
+        {
+            VARTYPE vt;
+            WORD wReserved1;
+            WORD wReserved2;
+            WORD wReserved3;
+            union
+            {
+                LONGLONG llVal;
+                LONG lVal;
+                BYTE bVal;
+                SHORT iVal;
+                FLOAT fltVal;
+                DOUBLE dblVal;
+                VARIANT_BOOL boolVal;
+                SCODE scode;
+                CY cyVal;
+                DATE date;
+                BSTR bstrVal;
+                IUnknown *punkVal;
+                IDispatch *pdispVal;
+                SAFEARRAY *parray;
+                BYTE *pbVal;
+                SHORT *piVal;
+                LONG *plVal;
+                LONGLONG *pllVal;
+                FLOAT *pfltVal;
+                DOUBLE *pdblVal;
+                VARIANT_BOOL *pboolVal;
+                SCODE *pscode;
+                CY *pcyVal;
+                DATE *pdate;
+                BSTR *pbstrVal;
+                IUnknown **ppunkVal;
+                IDispatch **ppdispVal;
+                SAFEARRAY **pparray;
+                struct tagVARIANT *pvarVal;
+                PVOID byref;
+                CHAR cVal;
+                USHORT uiVal;
+                ULONG ulVal;
+                ULONGLONG ullVal;
+                INT intVal;
+                UINT uintVal;
+                DECIMAL *pdecVal;
+                CHAR *pcVal;
+                USHORT *puiVal;
+                ULONG *pulVal;
+                ULONGLONG *pullVal;
+                INT *pintVal;
+                UINT *puintVal;
+            };
+        };
+        DECIMAL decVal;
+    };
+} VARIANT, VARIANTARG, *LPVARIANT;
+
+inline void VariantInit(VARIANT *v)
+{
+    v->vt = VT_EMPTY;
+}
+
+inline HRESULT SafeArrayDestroy(SAFEARRAY *psa);
+inline HRESULT SafeArrayCopy(SAFEARRAY *psa, SAFEARRAY **ppsa);
+
+inline HRESULT VariantClear(VARIANT *v)
+{
+    if (!(v->vt & VT_BYREF))
+    {
+        if (v->vt & VT_ARRAY)
+            SafeArrayDestroy(v->parray);
+        else if (VT_BSTR == v->vt)
+            SysFreeString(v->bstrVal);
+        else if ((VT_DISPATCH == v->vt || VT_UNKNOWN == v->vt) && v->punkVal)
+            v->punkVal->Release();
+    }
+    v->vt = VT_EMPTY;
+    return S_OK;
+}
+
+inline HRESULT VariantCopy(VARIANT *target, VARIANT const *source)
+{
+    if (target == source)
+        return S_OK;
+    VariantClear(target);
+    VARIANT copy = *source;
+    if (!(source->vt & VT_BYREF))
+    {
+        if (source->vt & VT_ARRAY)
+        {
+            HRESULT const hr = SafeArrayCopy(source->parray, &copy.parray);
+            if (FAILED(hr))
+                return hr;
+        }
+        else if (VT_BSTR == source->vt && source->bstrVal)
+        {
+            copy.bstrVal = SysAllocStringLen(source->bstrVal, SysStringLen(source->bstrVal));
+            if (!copy.bstrVal)
+                return E_OUTOFMEMORY;
+        }
+        else if ((VT_DISPATCH == source->vt || VT_UNKNOWN == source->vt) && source->punkVal)
+            source->punkVal->AddRef();
+    }
+    *target = copy;
+    return S_OK;
+}
+
+inline HRESULT VarR8FromDec(DECIMAL const *value, DOUBLE *result)
+{
+    if (value->scale > 28)
+        return E_INVALIDARG;
+    double x = double(value->Hi32) * 18446744073709551616.0 + double(value->Lo64);
+    for (BYTE i = 0; i < value->scale; ++i)
+        x /= 10;
+    *result = value->sign & DECIMAL_NEG ? -x: x;
+    return S_OK;
+}
+
+namespace mock {
+
+    inline ULONG element_size(VARTYPE vt)
+    {
+        switch (vt)
+        {
+        case VT_VARIANT: return sizeof(VARIANT);
+        case VT_DECIMAL: return sizeof(DECIMAL);
+        case VT_I1: case VT_UI1: return 1;
+        case VT_I2: case VT_UI2: case VT_BOOL: return 2;
+        case VT_R8: case VT_CY: case VT_DATE: case VT_I8: case VT_UI8: return 8;
+        case VT_BSTR: case VT_DISPATCH: case VT_UNKNOWN: return sizeof(void *);
+        default: return 4;
+        }
+    }
+
+    // copies one element out of or into an array, as OLE does
+    inline void copy_element(VARTYPE vt, void *target, void const *source)
+    {
+        switch (vt)
+        {
+        case VT_VARIANT:
+            {
+                VARIANT copy;
+                VariantInit(&copy);
+                VariantCopy(&copy, static_cast<VARIANT const *>(source));
+                memcpy(target, &copy, sizeof(copy));
+            }
+            break;
+        case VT_BSTR:
+            *static_cast<BSTR *>(target) = SysAllocString(*static_cast<BSTR const *>(source));
+            break;
+        case VT_DISPATCH:
+        case VT_UNKNOWN:
+            *static_cast<IUnknown **>(target) = *static_cast<IUnknown * const *>(source);
+            if (*static_cast<IUnknown **>(target))
+                (*static_cast<IUnknown **>(target))->AddRef();
+            break;
+        default:
+            memcpy(target, source, element_size(vt));
+            break;
+        }
+    }
+
+    inline void clear_element(VARTYPE vt, void *element)
+    {
+        switch (vt)
+        {
+        case VT_VARIANT:
+            VariantClear(static_cast<VARIANT *>(element));
+            break;
+        case VT_BSTR:
+            SysFreeString(*static_cast<BSTR *>(element));
+            break;
+        case VT_DISPATCH:
+        case VT_UNKNOWN:
+            if (*static_cast<IUnknown **>(element))
+                (*static_cast<IUnknown **>(element))->Release();
+            break;
+        default:
+            break;
+        }
+    }
+
+} // namespace mock
+
+inline SAFEARRAY *SafeArrayCreateVector(VARTYPE vt, LONG lower, ULONG count)
+{
+    SAFEARRAY *psa = static_cast<SAFEARRAY *>(calloc(1, sizeof(SAFEARRAY)));
+    psa->cDims = 1;
+    psa->vt = vt;
+    psa->cbElements = mock::element_size(vt);
+    psa->rgsabound[0].cElements = count;
+    psa->rgsabound[0].lLbound = lower;
+    psa->pvData = calloc(count ? count: 1, psa->cbElements);
+    return psa;
+}
+
+inline HRESULT SafeArrayDestroy(SAFEARRAY *psa)
+{
+    if (!psa)
+        return S_OK;
+    for (ULONG i = 0; i < psa->rgsabound[0].cElements; ++i)
+        mock::clear_element(psa->vt, static_cast<BYTE *>(psa->pvData) + i * psa->cbElements);
+    free(psa->pvData);
+    free(psa);
+    return S_OK;
+}
+
+inline HRESULT SafeArrayCopy(SAFEARRAY *psa, SAFEARRAY **ppsa)
+{
+    *ppsa = SafeArrayCreateVector(psa->vt, psa->rgsabound[0].lLbound, psa->rgsabound[0].cElements);
+    for (ULONG i = 0; i < psa->rgsabound[0].cElements; ++i)
+        mock::copy_element(psa->vt,
+            static_cast<BYTE *>((*ppsa)->pvData) + i * psa->cbElements,
+            static_cast<BYTE *>(psa->pvData) + i * psa->cbElements);
+    return S_OK;
+}
+
+inline UINT SafeArrayGetDim(SAFEARRAY *psa) { return psa->cDims; }
+
+inline HRESULT SafeArrayGetLBound(SAFEARRAY *psa, UINT dim, LONG *lower)
+{
+    if (1 != dim)
+        return DISP_E_BADINDEX;
+    *lower = psa->rgsabound[0].lLbound;
+    return S_OK;
+}
+
+inline HRESULT SafeArrayGetUBound(SAFEARRAY *psa, UINT dim, LONG *upper)
+{
+    if (1 != dim)
+        return DISP_E_BADINDEX;
+    *upper = psa->rgsabound[0].lLbound + LONG(psa->rgsabound[0].cElements) - 1;
+    return S_OK;
+}
+
+inline HRESULT SafeArrayGetElement(SAFEARRAY *psa, LONG *index, void *element)
+{
+    LONG const i = *index - psa->rgsabound[0].lLbound;
+    if (i < 0 || ULONG(i) >= psa->rgsabound[0].cElements)
+        return DISP_E_BADINDEX;
+    mock::copy_element(psa->vt, element, static_cast<BYTE *>(psa->pvData) + i * psa->cbElements);
+    return S_OK;
+}
+
+inline HRESULT SafeArrayPutElement(SAFEARRAY *psa, LONG *index, void const *element)
+{
+    LONG const i = *index - psa->rgsabound[0].lLbound;
+    if (i < 0 || ULONG(i) >= psa->rgsabound[0].cElements)
+        return DISP_E_BADINDEX;
+    void *slot = static_cast<BYTE *>(psa->pvData) + i * psa->cbElements;
+    mock::clear_element(psa->vt, slot);
+    if (VT_BSTR == psa->vt)
+        *static_cast<BSTR *>(slot) = SysAllocString(static_cast<OLECHAR const *>(element));
+    else if (VT_DISPATCH == psa->vt || VT_UNKNOWN == psa->vt)
+        mock::copy_element(psa->vt, slot, &element);
+    else
+        mock::copy_element(psa->vt, slot, element);
+    return S_OK;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//
+//  IDispatch and friends
+//
+typedef struct tagDISPPARAMS
+{
+    VARIANTARG *rgvarg;
+    DISPID *rgdispidNamedArgs;
+    UINT cArgs;
+    UINT cNamedArgs;
+} DISPPARAMS;
+
+typedef struct tagEXCEPINFO
+{
+    WORD wCode;
+    WORD wReserved;
+    BSTR bstrSource;
+    BSTR bstrDescription;
+    BSTR bstrHelpFile;
+    DWORD dwHelpContext;
+    PVOID pvReserved;
+    HRESULT (STDAPICALLTYPE *pfnDeferredFillIn)(struct tagEXCEPINFO *);
+    SCODE scode;
+} EXCEPINFO, *LPEXCEPINFO;
+
+MIDL_INTERFACE("00020400-0000-0000-C000-000000000046")
+IDispatch : public IUnknown
+{
+    STDMETHOD(GetTypeInfoCount)(UINT *pctinfo) PURE;
+    STDMETHOD(GetTypeInfo)(UINT iTInfo, LCID lcid, ITypeInfo **ppTInfo) PURE;
+    STDMETHOD(GetIDsOfNames)(REFIID riid, LPOLESTR *rgszNames, UINT cNames,
+                             LCID lcid, DISPID *rgDispId) PURE;
+    STDMETHOD(Invoke)(DISPID dispIdMember, REFIID riid, LCID lcid, WORD wFlags,
+                      DISPPARAMS *pDispParams, VARIANT *pVarResult,
+                      EXCEPINFO *pExcepInfo, UINT *puArgErr) PURE;
+};
+typedef IDispatch *LPDISPATCH;
+
+MIDL_INTERFACE("00020404-0000-0000-C000-000000000046")
+IEnumVARIANT : public IUnknown
+{
+    STDMETHOD(Next)(ULONG celt, VARIANT *rgVar, ULONG *pCeltFetched) PURE;
+    STDMETHOD(Skip)(ULONG celt) PURE;
+    STDMETHOD(Reset)() PURE;
+    STDMETHOD(Clone)(IEnumVARIANT **ppEnum) PURE;
+};
+
+MIDL_INTERFACE("00000001-0000-0000-C000-000000000046")
+IClassFactory : public IUnknown
+{
+    STDMETHOD(CreateInstance)(IUnknown *pUnkOuter, REFIID riid, void **ppvObject) PURE;
+    STDMETHOD(LockServer)(BOOL fLock) PURE;
+};
+
+MIDL_INTERFACE("6d5140c1-7436-11ce-8034-00aa006009fa")
+IServiceProvider : public IUnknown
+{
+    STDMETHOD(QueryService)(REFGUID guidService, REFIID riid, void **ppvObject) PURE;
+};
+
+#endif // APSL_MOCK_OBJBASE_H
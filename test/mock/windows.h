@@ -0,0 +1,552 @@
+//////////////////////////////////////////////////////////////////////////
+//
+//  windows.h stand-in for the portable test harness
+//
+//  Just enough of the Win32 API for aPSL.cpp to build and run on a POSIX
+//  system: integer types, interlocked operations, critical sections,
+//  TLS, events, semaphores, threads, the performance counter and code
+//  page conversion (CP_UTF8 exactly, CP_ACP as Latin-1).  Every kernel
+//  object shares one mutex and condition, which is slow but simple and
+//  good enough for a harness.
+//
+#ifndef APSL_MOCK_WINDOWS_H
+#define APSL_MOCK_WINDOWS_H
+
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <wchar.h>
+
+#if defined(__x86_64__) || defined(__aarch64__) || defined(__powerpc64__)
+#define _WIN64 1
+#endif
+
+#define WINAPI
+#define STDMETHODCALLTYPE
+#define STDAPICALLTYPE
+#define __stdcall
+#define __cdecl
+#define __RPC_FAR
+#define __assume(x) ((x) ? (void)0: __builtin_unreachable())
+#define __declspec(x) APSL_MOCK_DECLSPEC_##x
+#define APSL_MOCK_DECLSPEC_novtable
+#define APSL_MOCK_DECLSPEC_noreturn __attribute__((noreturn))
+#define APSL_MOCK_DECLSPEC_selectany __attribute__((weak))
+#define APSL_MOCK_DECLSPEC_uuid(x)
+
+#define VOID void
+#define CONST const
+#define TRUE 1
+#define FALSE 0
+#define MAX_PATH 260
+
+typedef void *PVOID, *LPVOID, *HANDLE;
+typedef void const *LPCVOID;
+typedef int BOOL, INT, *LPBOOL;
+typedef unsigned int UINT;
+typedef char CHAR, *LPSTR;
+typedef char const *LPCSTR;
+typedef unsigned char BYTE, UCHAR, *LPBYTE;
+typedef short SHORT;
+typedef unsigned short WORD, USHORT;
+typedef int32_t LONG, *LPLONG;
+typedef uint32_t ULONG, DWORD, *LPDWORD;
+typedef long long LONGLONG;
+typedef unsigned long long ULONGLONG, DWORD64;
+
+// Win32 is LLP64: long, and so its limits, are 32 bits like LONG
+#undef LONG_MIN
+#undef LONG_MAX
+#define LONG_MAX 2147483647L
+#define LONG_MIN (-LONG_MAX - 1L)
+#ifdef _WIN64
+typedef long long LONG_PTR, INT_PTR;
+typedef unsigned long long ULONG_PTR, DWORD_PTR, UINT_PTR;
+#else
+typedef int LONG_PTR, INT_PTR;
+typedef unsigned int ULONG_PTR, DWORD_PTR, UINT_PTR;
+#endif
+typedef float FLOAT;
+typedef double DOUBLE;
+typedef wchar_t WCHAR, *LPWSTR;
+typedef wchar_t const *LPCWSTR;
+typedef LONG HRESULT;
+typedef HANDLE HINSTANCE, HMODULE;
+
+typedef union _LARGE_INTEGER
+{
+    struct { DWORD LowPart; LONG HighPart; };
+    LONGLONG QuadPart;
+} LARGE_INTEGER;
+
+typedef struct _SYSTEM_INFO
+{
+    DWORD dwNumberOfProcessors;
+} SYSTEM_INFO;
+
+#define ZeroMemory(p, n) memset((p), 0, (n))
+#define CopyMemory(d, s, n) memcpy((d), (s), (n))
+
+#define ERROR_SUCCESS 0L
+#define ERROR_NOT_ENOUGH_MEMORY 8L
+#define ERROR_INVALID_PARAMETER 87L
+#define ERROR_INSUFFICIENT_BUFFER 122L
+#define ERROR_NO_UNICODE_TRANSLATION 1113L
+
+#define INFINITE 0xFFFFFFFFUL
+#define WAIT_OBJECT_0 0UL
+#define WAIT_TIMEOUT 258UL
+#define WAIT_FAILED 0xFFFFFFFFUL
+#define TLS_OUT_OF_INDEXES 0xFFFFFFFFUL
+#define DLL_PROCESS_ATTACH 1
+#define DLL_PROCESS_DETACH 0
+
+#define CP_ACP 0
+#define CP_UTF8 65001
+#define MB_ERR_INVALID_CHARS 0x8
+#define WC_ERR_INVALID_CHARS 0x80
+
+#define _TRUNCATE (size_t(-1))
+
+//////////////////////////////////////////////////////////////////////////
+//
+//  last error, interlocked operations
+//
+namespace mock {
+
+    inline DWORD& last_error()
+    {
+        static __thread DWORD error = 0;
+        return error;
+    }
+
+} // namespace mock
+
+inline DWORD GetLastError() { return mock::last_error(); }
+inline void SetLastError(DWORD error) { mock::last_error() = error; }
+
+inline LONG InterlockedIncrement(LONG volatile *p) { return __sync_add_and_fetch(p, 1); }
+inline LONG InterlockedDecrement(LONG volatile *p) { return __sync_sub_and_fetch(p, 1); }
+inline LONG InterlockedExchange(LONG volatile *p, LONG x) { return __sync_lock_test_and_set(p, x); }
+inline LONG InterlockedExchangeAdd(LONG volatile *p, LONG x) { return __sync_fetch_and_add(p, x); }
+inline LONG InterlockedCompareExchange(LONG volatile *p, LONG x, LONG comparand)
+{
+    return __sync_val_compare_and_swap(p, comparand, x);
+}
+inline LONGLONG InterlockedIncrement64(LONGLONG volatile *p) { return __sync_add_and_fetch(p, 1); }
+inline LONGLONG InterlockedDecrement64(LONGLONG volatile *p) { return __sync_sub_and_fetch(p, 1); }
+inline LONGLONG InterlockedExchange64(LONGLONG volatile *p, LONGLONG x) { return __sync_lock_test_and_set(p, x); }
+inline LONGLONG InterlockedExchangeAdd64(LONGLONG volatile *p, LONGLONG x) { return __sync_fetch_and_add(p, x); }
+inline LONGLONG InterlockedCompareExchange64(LONGLONG volatile *p, LONGLONG x, LONGLONG comparand)
+{
+    return __sync_val_compare_and_swap(p, comparand, x);
+}
+inline PVOID InterlockedCompareExchangePointer(PVOID volatile *p, PVOID x, PVOID comparand)
+{
+    return __sync_val_compare_and_swap(p, comparand, x);
+}
+inline void MemoryBarrier() { __sync_synchronize(); }
+
+//////////////////////////////////////////////////////////////////////////
+//
+//  critical sections and TLS
+//
+typedef struct _CRITICAL_SECTION
+{
+    pthread_mutex_t mutex;
+} CRITICAL_SECTION, *LPCRITICAL_SECTION;
+
+inline void InitializeCriticalSection(LPCRITICAL_SECTION p)
+{
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&p->mutex, &attr);
+    pthread_mutexattr_destroy(&attr);
+}
+inline void DeleteCriticalSection(LPCRITICAL_SECTION p) { pthread_mutex_destroy(&p->mutex); }
+inline void EnterCriticalSection(LPCRITICAL_SECTION p) { pthread_mutex_lock(&p->mutex); }
+inline void LeaveCriticalSection(LPCRITICAL_SECTION p) { pthread_mutex_unlock(&p->mutex); }
+
+inline DWORD TlsAlloc()
+{
+    pthread_key_t key;
+    if (pthread_key_create(&key, NULL))
+        return TLS_OUT_OF_INDEXES;
+    return DWORD(key);
+}
+inline BOOL TlsFree(DWORD slot) { return 0 == pthread_key_delete(pthread_key_t(slot)); }
+inline LPVOID TlsGetValue(DWORD slot)
+{
+    SetLastError(ERROR_SUCCESS);
+    return pthread_getspecific(pthread_key_t(slot));
+}
+inline BOOL TlsSetValue(DWORD slot, LPVOID value)
+{
+    return 0 == pthread_setspecific(pthread_key_t(slot), value);
+}
+
+//////////////////////////////////////////////////////////////////////////
+//
+//  kernel objects: events, semaphores and threads
+//
+namespace mock {
+
+    struct kernel
+    {
+        pthread_mutex_t mutex;
+        pthread_cond_t changed;
+    };
+
+    inline kernel& kernel_state()
+    {
+        static kernel k = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER };
+        return k;
+    }
+
+    struct kernel_object
+    {
+        enum kind_type { EVENT, SEMAPHORE, THREAD };
+
+        kind_type kind;
+        bool manual_reset;
+        LONG count;     // event: signalled; semaphore: count; thread: finished
+        LONG maximum;
+        pthread_t thread;
+        DWORD (*start)(LPVOID);
+        LPVOID param;
+
+        // called with the kernel mutex held
+        bool try_acquire()
+        {
+            if (0 == count)
+                return false;
+            if ((EVENT == kind && !manual_reset) || SEMAPHORE == kind)
+                --count;
+            return true;
+        }
+    };
+
+    inline void *thread_main(void *param)
+    {
+        kernel_object *object = static_cast<kernel_object *>(param);
+        object->start(object->param);
+        pthread_mutex_lock(&kernel_state().mutex);
+        object->count = 1;
+        pthread_cond_broadcast(&kernel_state().changed);
+        pthread_mutex_unlock(&kernel_state().mutex);
+        return NULL;
+    }
+
+    inline void signal(kernel_object *object, LONG count)
+    {
+        pthread_mutex_lock(&kernel_state().mutex);
+        object->count = count;
+        pthread_cond_broadcast(&kernel_state().changed);
+        pthread_mutex_unlock(&kernel_state().mutex);
+    }
+
+    inline void deadline(timespec& when, DWORD milliseconds)
+    {
+        clock_gettime(CLOCK_REALTIME, &when);
+        when.tv_sec += milliseconds / 1000;
+        when.tv_nsec += long(milliseconds % 1000) * 1000000L;
+        if (when.tv_nsec >= 1000000000L)
+        {
+            when.tv_sec += 1;
+            when.tv_nsec -= 1000000000L;
+        }
+    }
+
+} // namespace mock
+
+typedef DWORD (*LPTHREAD_START_ROUTINE)(LPVOID);
+typedef void *LPSECURITY_ATTRIBUTES;
+
+inline HANDLE CreateEvent(LPSECURITY_ATTRIBUTES, BOOL manual_reset, BOOL initial_state, LPCSTR)
+{
+    mock::kernel_object *object = new mock::kernel_object();
+    object->kind = mock::kernel_object::EVENT;
+    object->manual_reset = 0 != manual_reset;
+    object->count = initial_state ? 1: 0;
+    return object;
+}
+
+inline HANDLE CreateSemaphore(LPSECURITY_ATTRIBUTES, LONG initial, LONG maximum, LPCSTR)
+{
+    mock::kernel_object *object = new mock::kernel_object();
+    object->kind = mock::kernel_object::SEMAPHORE;
+    object->count = initial;
+    object->maximum = maximum;
+    return object;
+}
+
+inline HANDLE CreateThread(LPSECURITY_ATTRIBUTES, size_t, LPTHREAD_START_ROUTINE start,
+                           LPVOID param, DWORD, LPDWORD id)
+{
+    mock::kernel_object *object = new mock::kernel_object();
+    object->kind = mock::kernel_object::THREAD;
+    object->start = start;
+    object->param = param;
+    if (pthread_create(&object->thread, NULL, &mock::thread_main, object))
+    {
+        delete object;
+        SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+        return NULL;
+    }
+    if (id)
+        *id = 0;
+    return object;
+}
+
+inline BOOL SetEvent(HANDLE h) { mock::signal(static_cast<mock::kernel_object *>(h), 1); return TRUE; }
+inline BOOL ResetEvent(HANDLE h) { mock::signal(static_cast<mock::kernel_object *>(h), 0); return TRUE; }
+
+inline BOOL ReleaseSemaphore(HANDLE h, LONG n, LPLONG previous)
+{
+    mock::kernel_object *object = static_cast<mock::kernel_object *>(h);
+    pthread_mutex_lock(&mock::kernel_state().mutex);
+    if (previous)
+        *previous = object->count;
+    object->count += n;
+    if (object->count > object->maximum)
+        object->count = object->maximum;
+    pthread_cond_broadcast(&mock::kernel_state().changed);
+    pthread_mutex_unlock(&mock::kernel_state().mutex);
+    return TRUE;
+}
+
+inline DWORD WaitForMultipleObjects(DWORD n, HANDLE const *handles, BOOL all, DWORD milliseconds)
+{
+    timespec when;
+    mock::deadline(when, INFINITE == milliseconds ? 0: milliseconds);
+    mock::kernel& k = mock::kernel_state();
+    pthread_mutex_lock(&k.mutex);
+    for (;;)
+    {
+        if (all)
+        {
+            DWORD ready = 0;
+            for (DWORD i = 0; i < n; ++i)
+                ready += static_cast<mock::kernel_object *>(handles[i])->count ? 1: 0;
+            if (ready == n)
+            {
+                for (DWORD i = 0; i < n; ++i)
+                    static_cast<mock::kernel_object *>(handles[i])->try_acquire();
+                pthread_mutex_unlock(&k.mutex);
+                return WAIT_OBJECT_0;
+            }
+        }
+        else
+        {
+            for (DWORD i = 0; i < n; ++i)
+                if (static_cast<mock::kernel_object *>(handles[i])->try_acquire())
+                {
+                    pthread_mutex_unlock(&k.mutex);
+                    return WAIT_OBJECT_0 + i;
+                }
+        }
+        if (0 == milliseconds)
+            break;
+        if (INFINITE == milliseconds)
+            pthread_cond_wait(&k.changed, &k.mutex);
+        else if (ETIMEDOUT == pthread_cond_timedwait(&k.changed, &k.mutex, &when))
+            milliseconds = 0; // one last look
+    }
+    pthread_mutex_unlock(&k.mutex);
+    return WAIT_TIMEOUT;
+}
+
+inline DWORD WaitForSingleObject(HANDLE h, DWORD milliseconds)
+{
+    return WaitForMultipleObjects(1, &h, TRUE, milliseconds);
+}
+
+inline BOOL CloseHandle(HANDLE h)
+{
+    mock::kernel_object *object = static_cast<mock::kernel_object *>(h);
+    if (mock::kernel_object::THREAD == object->kind)
+        pthread_join(object->thread, NULL);
+    delete object;
+    return TRUE;
+}
+
+inline void Sleep(DWORD milliseconds) { usleep(useconds_t(milliseconds) * 1000); }
+
+inline void GetSystemInfo(SYSTEM_INFO *info)
+{
+    long const n = sysconf(_SC_NPROCESSORS_ONLN);
+    info->dwNumberOfProcessors = n > 0 ? DWORD(n): 1;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//
+//  time
+//
+inline BOOL QueryPerformanceCounter(LARGE_INTEGER *count)
+{
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    count->QuadPart = LONGLONG(now.tv_sec) * 1000000000LL + now.tv_nsec;
+    return TRUE;
+}
+
+inline BOOL QueryPerformanceFrequency(LARGE_INTEGER *frequency)
+{
+    frequency->QuadPart = 1000000000LL;
+    return TRUE;
+}
+
+inline DWORD GetTickCount()
+{
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return DWORD(ULONGLONG(now.tv_sec) * 1000 + now.tv_nsec / 1000000);
+}
+
+//////////////////////////////////////////////////////////////////////////
+//
+//  code pages; wchar_t holds code points, CP_ACP is Latin-1
+//
+inline int WideCharToMultiByte(UINT codepage, DWORD, LPCWSTR source, int count,
+                               LPSTR target, int size, LPCSTR, LPBOOL)
+{
+    if (count < 0)
+        count = int(wcslen(source)) + 1;
+    int length = 0;
+    for (int i = 0; i < count; ++i)
+    {
+        ULONG const c = ULONG(source[i]);
+        unsigned char bytes[4];
+        int n = 0;
+        if (CP_UTF8 != codepage)
+            bytes[n++] = c < 0x100 ? (unsigned char)c: '?';
+        else if (c < 0x80)
+            bytes[n++] = (unsigned char)c;
+        else if (c < 0x800)
+        {
+            bytes[n++] = (unsigned char)(0xC0 | (c >> 6));
+            bytes[n++] = (unsigned char)(0x80 | (c & 0x3F));
+        }
+        else if (c < 0x10000)
+        {
+            bytes[n++] = (unsigned char)(0xE0 | (c >> 12));
+            bytes[n++] = (unsigned char)(0x80 | ((c >> 6) & 0x3F));
+            bytes[n++] = (unsigned char)(0x80 | (c & 0x3F));
+        }
+        else
+        {
+            bytes[n++] = (unsigned char)(0xF0 | (c >> 18));
+            bytes[n++] = (unsigned char)(0x80 | ((c >> 12) & 0x3F));
+            bytes[n++] = (unsigned char)(0x80 | ((c >> 6) & 0x3F));
+            bytes[n++] = (unsigned char)(0x80 | (c & 0x3F));
+        }
+        if (size)
+        {
+            if (length + n > size)
+            {
+                SetLastError(ERROR_INSUFFICIENT_BUFFER);
+                return 0;
+            }
+            memcpy(target + length, bytes, n);
+        }
+        length += n;
+    }
+    return length;
+}
+
+inline int MultiByteToWideChar(UINT codepage, DWORD, LPCSTR source, int count,
+                               LPWSTR target, int size)
+{
+    if (count < 0)
+        count = int(strlen(source)) + 1;
+    unsigned char const *p = reinterpret_cast<unsigned char const *>(source);
+    int length = 0;
+    for (int i = 0; i < count; ++length)
+    {
+        ULONG c = p[i++];
+        if (CP_UTF8 == codepage && c >= 0x80)
+        {
+            int extra = c >= 0xF0 ? 3: c >= 0xE0 ? 2: c >= 0xC0 ? 1: 0;
+            c &= 0x3F >> extra;
+            for (; extra && i < count && 0x80 == (p[i] & 0xC0); --extra)
+                c = (c << 6) | (p[i++] & 0x3F);
+            if (extra)
+                c = 0xFFFD;
+        }
+        if (size)
+        {
+            if (length >= size)
+            {
+                SetLastError(ERROR_INSUFFICIENT_BUFFER);
+                return 0;
+            }
+            target[length] = wchar_t(c);
+        }
+    }
+    return length;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//
+//  formatting; %I64 and the 32 bit %l of the Microsoft runtime
+//
+namespace mock {
+
+    inline void translate_format(char const *format, char *result, size_t size)
+    {
+        size_t n = 0;
+        for (char const *p = format; *p && n + 3 < size; ++p)
+        {
+            result[n++] = *p;
+            if ('%' != *p)
+                continue;
+            while (p[1] && strchr("-+ #0123456789.", p[1]))
+                result[n++] = *++p;
+            if (0 == strncmp(p + 1, "I64", 3))
+            {
+                result[n++] = 'l';
+                result[n++] = 'l';
+                p += 3;
+            }
+            else if ('l' == p[1] && p[2] && strchr("diuxX", p[2]))
+                ++p; // LONG and DWORD are 32 bits here
+        }
+        result[n] = 0;
+    }
+
+} // namespace mock
+
+template <size_t N>
+inline int _snprintf_s(char (&buffer)[N], size_t, char const *format, ...)
+{
+    char translated[256];
+    mock::translate_format(format, translated, sizeof(translated));
+    va_list args;
+    va_start(args, format);
+    int const n = vsnprintf(buffer, N, translated, args);
+    va_end(args);
+    return n < int(N) ? n: -1;
+}
+
+inline int wsprintfA(LPSTR buffer, LPCSTR format, ...)
+{
+    char translated[256];
+    mock::translate_format(format, translated, sizeof(translated));
+    va_list args;
+    va_start(args, format);
+    int const n = vsnprintf(buffer, 1024, translated, args);
+    va_end(args);
+    return n;
+}
+
+#include "objbase.h"
+
+#endif // APSL_MOCK_WINDOWS_H